@@ -0,0 +1,183 @@
+;;;       Blit - ILI9481 8080 bus pixel loops for lcd.h
+;;
+;;        Called from C (see lcd.h) between WriteRegion and ReleaseLcd, with
+;;        CS active and CD inactive. Each pixel is sent as its high byte then
+;;        its low byte on PORTD, each latched by a WR strobe on PORTC.
+;;
+;;        avr-gcc calling convention: arguments in r25:r24, r23:r22; r18-r27,
+;;        r30, r31 and r0 may be used, r1 is zero.
+
+
+
+
+;         ATmega328 registers used in this module
+
+          .equ   PORTC, 0x08 ; LCD control signals
+          .equ   PORTD, 0x0B ; LCD data
+
+          .equ   WRLO,  0b00101010 ; PORTC with CS and WR active, CD inactive
+          .equ   WRHI,  0b00101110 ; PORTC with CS active, WR and CD inactive
+
+
+          .global BlitFill
+          .global RepeatDataWord
+          .global BlitFlash
+
+          .text
+
+
+
+
+;;;       RepeatDataWord - send a run of up to 256 pixels of one colour
+;;
+;;        entry  r25:r24 - colour
+;;               r22     - number of pixels, 0 for 256
+
+RepeatDataWord:
+          clr    r23
+          tst    r22
+          brne   BlitFill
+          inc    r23         ; 0 => 256, then continue as BlitFill
+
+
+
+
+;;;       BlitFill - send pixels of one colour
+;;
+;;        entry  r25:r24 - colour
+;;               r23:r22 - number of pixels, may be 0
+;;
+;;        Pixels are sent one at a time until a multiple of 8 remain, then 8
+;;        at a time:
+;;
+;;          bytes differ  9 cycles a pixel, then 52 per 8 = 6.5 cycles a pixel
+;;          bytes match   7 cycles a pixel, then 36 per 8 = 4.5 cycles a pixel
+;;
+;;        When the two bytes match, as for black and white, PORTD is loaded
+;;        once and each pixel is just its two WR strobes.
+
+BlitFill:
+          ldi    r18,WRLO
+          ldi    r19,WRHI
+          mov    r20,r22     ; r20 = pixels sent singly
+          andi   r20,7
+          movw   r26,r22     ; X = groups of 8 pixels
+          lsr    r27
+          ror    r26
+          lsr    r27
+          ror    r26
+          lsr    r27
+          ror    r26
+          cp     r24,r25
+          breq   bfs2        ; Both bytes the same
+
+          tst    r20
+          breq   bfd3
+
+bfd2:     out    PORTD,r25   ; (1) High byte
+          out    PORTC,r18   ; (1) WR low
+          out    PORTC,r19   ; (1) WR high latches it
+          out    PORTD,r24   ; (1) Low byte
+          out    PORTC,r18   ; (1)
+          out    PORTC,r19   ; (1)
+          dec    r20         ; (1)
+          brne   bfd2        ; (2)
+
+bfd3:     sbiw   r26,1       ; (2)
+          brcs   bfd5        ; (1) No more groups
+
+bfd4:     .rept  8
+          out    PORTD,r25   ; (1)
+          out    PORTC,r18   ; (1)
+          out    PORTC,r19   ; (1)
+          out    PORTD,r24   ; (1)
+          out    PORTC,r18   ; (1)
+          out    PORTC,r19   ; (1)
+          .endr
+          sbiw   r26,1       ; (2)
+          brcc   bfd4        ; (2)
+
+bfd5:     ret
+
+
+bfs2:     out    PORTD,r24   ; Data stays on PORTD throughout
+          tst    r20
+          breq   bfs4
+
+bfs3:     out    PORTC,r18   ; (1) WR low
+          out    PORTC,r19   ; (1) WR high latches high byte
+          out    PORTC,r18   ; (1)
+          out    PORTC,r19   ; (1) Latches low byte
+          dec    r20         ; (1)
+          brne   bfs3        ; (2)
+
+bfs4:     sbiw   r26,1       ; (2)
+          brcs   bfs6        ; (1)
+
+bfs5:     .rept  8
+          out    PORTC,r18   ; (1)
+          out    PORTC,r19   ; (1)
+          out    PORTC,r18   ; (1)
+          out    PORTC,r19   ; (1)
+          .endr
+          sbiw   r26,1       ; (2)
+          brcc   bfs5        ; (2)
+
+bfs6:     ret
+
+
+
+
+;;;       BlitFlash - send pixels from flash
+;;
+;;        entry  r25:r24 - flash address of the first pixel, stored low byte first
+;;               r23:r22 - number of pixels, may be 0
+;;
+;;        Singly 15 cycles a pixel, then 100 per 8 = 12.5 cycles a pixel. The
+;;        two 3 cycle lpm's bound the loop: the bus strobes take 6.
+
+BlitFlash:
+          ldi    r18,WRLO
+          ldi    r19,WRHI
+          movw   r30,r24     ; Z = pixels
+          mov    r20,r22
+          andi   r20,7
+          movw   r26,r22
+          lsr    r27
+          ror    r26
+          lsr    r27
+          ror    r26
+          lsr    r27
+          ror    r26
+
+          tst    r20
+          breq   bfl3
+
+bfl2:     lpm    r24,Z+      ; (3) Low byte
+          lpm    r25,Z+      ; (3) High byte
+          out    PORTD,r25   ; (1)
+          out    PORTC,r18   ; (1)
+          out    PORTC,r19   ; (1)
+          out    PORTD,r24   ; (1)
+          out    PORTC,r18   ; (1)
+          out    PORTC,r19   ; (1)
+          dec    r20         ; (1)
+          brne   bfl2        ; (2)
+
+bfl3:     sbiw   r26,1       ; (2)
+          brcs   bfl5        ; (1)
+
+bfl4:     .rept  8
+          lpm    r24,Z+      ; (3)
+          lpm    r25,Z+      ; (3)
+          out    PORTD,r25   ; (1)
+          out    PORTC,r18   ; (1)
+          out    PORTC,r19   ; (1)
+          out    PORTD,r24   ; (1)
+          out    PORTC,r18   ; (1)
+          out    PORTC,r19   ; (1)
+          .endr
+          sbiw   r26,1       ; (2)
+          brcc   bfl4        ; (2)
+
+bfl5:     ret
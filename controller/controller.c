@@ -33,6 +33,8 @@
 //           |    |     +-----|7 Miso
 //       10u +-||-+           |8 Irq
 //                            +--------
+//
+//  nRF24L01+ Irq (8) is not connected: wireless.h polls STATUS instead.
 
 
 
@@ -55,232 +57,652 @@ typedef uint32_t  u32;
 typedef uint16_t FlashAddr;
 
 
-// LCD control signals (active low)
+#include "probe.h"
+#include "lcd.h"
+
+
+// InitLCD is a sequence of INITLCDSTEPS steps, each returning the ms to
+// wait before the next, so that the ILI9481's reset and sleep exit waits can
+// overlap other work (see BootTask).
+
+#define INITLCDSTEPS 6
+
+u8 InitLCDStep(u8 step) {
+  switch (step) {
+    case 0:
+      // Port B: Set all pins as inputs with pull-ups activated.
+      DDRB  = 0b00000000;
+      PORTB = 0b11111111;
+
+      // Enable pin change interrupts for combined knob/pushbutton connections
+      PCMSK0 = 0x83;  // PORTB pins 7, 1 and 0.
+      PCICR  = 1;     // Enable interrupt on PCINT pins 0 through 7 (where enabled in PCMSK0)
+
+      // PORTD - LCD byte data and command io
+      DDRD  = 0b11111111;    // Port D is output
+      PORTD = 0b00000000;
+
+      //          R
+      //          sCRWR
+      //          tSSRD
+      PORTC = 0b00111111;    // Set RD, WR, CD, CS and Reset outputs high, set pull up on inputs.
+      DDRC  = 0b00111111;    // Set RD, WR, CD, CS and Reset pins as outputs.
+      return 50;
+
+    case 1:
+      PORTC = 0b00011111;    // Hold reset low for 2ms
+      return 2;
+
+    case 2:
+      PORTC = 0b00111111;    // Reset high and wait 50ms
+      return 50;
+
+    case 3:
+      CommandLcd(Bytes(0x01));                               // Soft Reset and wait 20 ms (more than 10 frame times)
+      return 20;
+
+    case 4:
+      PORTC = 0b00111110; // Debug - take PORTC.0 low to trigger oscilloscope.
+
+      CommandLcd(Bytes(0x28));                               // Display Off
+      CommandLcd(Bytes(0x3A, 0x55));                         // Pixel read=565, write=565.
+      CommandLcd(Bytes(0xB0, 0x00));                         // unlocks E0, F0
+      CommandLcd(Bytes(0xB3, 0x02, 0x00, 0x00, 0x00));       // Frame Memory, interface [02 00 00 00] (default on reset)
+      CommandLcd(Bytes(0xB4, 0x00));                         // Frame mode [00] (default on reset)
+      CommandLcd(Bytes(0xD0, 0x07, 0x42, 0x18));             // Set Power [00 43 18] x1.00, x6, x3
+      CommandLcd(Bytes(0xD1, 0x00, 0x07, 0x10));             // Set VCOM  [00 00 00] x0.72, x1.02
+      CommandLcd(Bytes(0xD2, 0x01, 0x02));                   // Set Power for Normal Mode [01 22]
+      CommandLcd(Bytes(0xD3, 0x01, 0x02));                   // Set Power for Partial Mode [01 22]
+      CommandLcd(Bytes(0xD4, 0x01, 0x02));                   // Set Power for Idle Mode [01 22]
+    //CommandLcd(Bytes(0xC0, 0x12, 0x3B, 0x00, 0x02, 0x11)); // Panel Driving BGR for 1581 [10 3B 00 02 11]
+      CommandLcd(Bytes(0xC0, 0x10, 0x3B, 0x00, 0x02, 0x11)); // Panel Driving BGR for 1581 [10 3B 00 02 11]
+      CommandLcd(Bytes(0xC1, 0x10, 0x10, 0x88));             // Display Timing Normal [10 10 88]
+      CommandLcd(Bytes(0xC5, 0x03));                         // Frame Rate [03]
+      CommandLcd(Bytes(0xC6, 0x02));                         // Interface Control [02]
+
+    //CommandLcd(Bytes(0xC8, 0x00, 0x32, 0x36, 0x45,         // Gamma settings
+    //                 0x06, 0x16, 0x37, 0x75, 0x77,
+    //                 0x54, 0x0C, 0x00));
+    //
+      CommandLcd(Bytes(0x11));                               // Exit sleep mode.
+      return 150;
+  }
 
-#define Rs  0b11011111  // Reset
-#define Cs  0b11101111  // Chip select
-#define Cd  0b11110111  // Command mode
-#define Wr  0b11111011  // Write strobe
-#define Rd  0b11111101  // Read strobe
+  CommandLcd(Bytes(0x29));                                   // Display on.
+  CommandLcd(Bytes(0x20));                                   // Exit invert mode.
+  CommandLcd(Bytes(0x36, 0x0A));                             // Default address mode. Sets BGR order and horiz flip.
+  return 0;
+}
 
-#define LcdIdle 0b00111110  // Reset, Cs, Cd Ww and Rd inactive
 
-#define CsCdWr    (LcdIdle & Cs & Cd & Wr)  // CS, CD and WR active
-#define CsCdNwr   (LcdIdle & Cs & Cd     )  // CS and CD active, WR inactive
-#define CsNcdNwr  (LcdIdle & Cs          )  // CS active, CD and WR inactive
-#define CsNcdWr   (LcdIdle & Cs      & Wr)  // CS active, CD inactive, WR active
+#include "ui.h"
+#include "knobs.h"
+#include "wireless.h"
 
-//#define Bytes(...) (u8[]){__VA_ARGS__}
-//template <int len> void CommandLcd(u8 const(&buf)[len]) {
 
-#define Bytes(...) (u8[]){__VA_ARGS__}, sizeof((u8[]){__VA_ARGS__})
+// Eeprom access for scenes.h
 
-void SendCommand(u8 cmd) {
-  PORTC = CsCdWr;  // CS, CD and WR active
-  PORTD = cmd;
-  PORTC = CsCdNwr;  // CS, CD active, WR inactive
-  PORTC = CsNcdNwr;  // CS remains active, CD goes high to return to data mode
-}
+u8 EepromBusy() {return EECR & (1<<EEPE);}
 
-void CommandLcd(const u8 *buf, u8 len) {
-  SendCommand(buf[0]);
-  buf++; len--;
-  while (len--) {
-    PORTC = CsNcdWr;   // CS and WR active, CD inactive
-    PORTD = *(buf++);
-    PORTC = CsNcdNwr;  // CS active, WR and CD inactive
-  }
-  PORTC = LcdIdle;  // CS and CD both go inactive
+u8 EepromRead(u16 address) {
+  while (EepromBusy()) {}
+  EEAR = address;
+  EECR |= 1<<EERE;
+  return EEDR;
 }
 
-void SendDataWord(u16 w) {
-  PORTC = CsNcdWr; PORTD = w / 256; PORTC = CsNcdNwr;
-  PORTC = CsNcdWr; PORTD = w % 256; PORTC = CsNcdNwr;
+void EepromWrite(u16 address, u8 value) {
+  EEAR = address;
+  EEDR = value;
+  u8 sreg = SREG;  cli();
+  EECR = 1<<EEMPE;   // EEPM = 0: erase and write
+  EECR |= 1<<EEPE;   // Within 4 cycles of EEMPE
+  SREG = sreg;
 }
 
-void RepeatDataWord(u16 w, u8 len) { // len 0 => 256 times.
-  if (w/256 == w%256) { // Optimise for common case of all black or all white and some others
-    PORTD = w / 256;
-    do {PORTC=CsNcdWr; PORTC=CsNcdNwr; PORTC=CsNcdWr; PORTC=CsNcdNwr; len--;} while (len);
-  } else {
-    do {
-      PORTC = CsNcdWr; PORTD = w / 256; PORTC = CsNcdNwr;
-      PORTC = CsNcdWr; PORTD = w % 256; PORTC = CsNcdNwr;
-      len--;
-    } while (len);
-  }
-}
+#include "scenes.h"
+#include "effects.h"
 
-u8 u6sqrt(u16 n) {  // from 12 bit (0..4095) to 6 bit (0 .. 63)
-  u8 result;
-  // n is passed in rB:rA
-  // uses
-  //   r23 - mask
-  //   r22 - sqrt
-  //   r21 - check
-  asm(
-    "        ldi   r23,0x20       ; mask (sufficient for 0 <= n <= 4095) \n"
-    "        eor   r22,r22        ; sqrt                                 \n"
-    "                                                                    \n"
-    "isqr2:  mov   r21,r22        ; check = sqrt                         \n"
-    "        add   r21,r23        ; check += mask                        \n"
-    "        mul   r21,r21        ; r1:r0 = check*check                  \n"
-    "        cp    r0,%A1         ; compare check*check with parameter n \n"
-    "        cpc   r1,%B1                                                \n"
-    "        brcc  isqr4          ; if check*check > n                   \n"
-    "                                                                    \n"
-    "        mov   r22,r21        ; sqrt = check                         \n"
-    "                                                                    \n"
-    "isqr4:  lsr   r23            ; mask >>= 1                           \n"
-    "        brne  isqr2          ; loop if mask nonzero                 \n"
-    "                                                                    \n"
-    "        eor   r1,r1          ; restore r1==0 invariant              \n"
-    "        mov   %0,r22         ; return sqrt                          \n"
-  : "=r" (result)             // Result should be assigned to register %0
-  : "r"  (n)                  // Parameter will be found in registers %A1 and %B1
-  : "r21", "r22", "r23");
-  return result;
-}
 
-void WriteRegion(u16 x0, u16 y0, u16 x1, u16 y1) {
-  SendCommand(0x2A); SendDataWord(x0); SendDataWord(x1);
-  SendCommand(0x2B); SendDataWord(y0); SendDataWord(y1);
-  SendCommand(0x2C);
-}
+ISR(PCINT0_vect)     {PinChangeInterrupt();}
+ISR(SPI_STC_vect)    {SpiInterrupt();}
+ISR(BADISR_vect)     {}
+ISR(TIMER0_OVF_vect)   {Timer0Overflow();}
+ISR(TIMER0_COMPA_vect) {Timer0Interrupt();}
 
-void InitLCD() {
-  // Port B: Set all pins as inputs with pull-ups activated.
-  DDRB  = 0b00000000;
-  PORTB = 0b11111111;
-
-  // Enable pin change interrupts for combined knob/pushbutton connections
-  PCMSK0 = 0x83;  // PORTB pins 7, 1 and 0.
-  PCICR  = 1;     // Enable interrupt on PCINT pins 0 through 7 (where enabled in PCMSK0)
-
-  // PORTD - LCD byte data and command io
-  DDRD  = 0b11111111;    // Port D is output
-  PORTD = 0b00000000;
-
-  //          R
-  //          sCRWR
-  //          tSSRD
-  PORTC = 0b00111111;    // Set RD, WR, CD, CS and Reset outputs high, set pull up on inputs.
-  DDRC  = 0b00111111;    // Set RD, WR, CD, CS and Reset pins as outputs.
-
-  delay(50);
-  PORTC = 0b00011111;    // Hold reset low for 2ms
-  delay(2);
-  PORTC = 0b00111111;    // Reset high and wait 50ms
-  delay(50);
-
-  CommandLcd(Bytes(0x01));                               // Soft Reset and wait 20 ms (more than 10 frame times)
-  delay(20);
-
-  PORTC = 0b00111110; // Debug - take PORTC.0 low to trigger oscilloscope.
-
-  CommandLcd(Bytes(0x28));                               // Display Off
-  CommandLcd(Bytes(0x3A, 0x55));                         // Pixel read=565, write=565.
-  CommandLcd(Bytes(0xB0, 0x00));                         // unlocks E0, F0
-  CommandLcd(Bytes(0xB3, 0x02, 0x00, 0x00, 0x00));       // Frame Memory, interface [02 00 00 00] (default on reset)
-  CommandLcd(Bytes(0xB4, 0x00));                         // Frame mode [00] (default on reset)
-  CommandLcd(Bytes(0xD0, 0x07, 0x42, 0x18));             // Set Power [00 43 18] x1.00, x6, x3
-  CommandLcd(Bytes(0xD1, 0x00, 0x07, 0x10));             // Set VCOM  [00 00 00] x0.72, x1.02
-  CommandLcd(Bytes(0xD2, 0x01, 0x02));                   // Set Power for Normal Mode [01 22]
-  CommandLcd(Bytes(0xD3, 0x01, 0x02));                   // Set Power for Partial Mode [01 22]
-  CommandLcd(Bytes(0xD4, 0x01, 0x02));                   // Set Power for Idle Mode [01 22]
-//CommandLcd(Bytes(0xC0, 0x12, 0x3B, 0x00, 0x02, 0x11)); // Panel Driving BGR for 1581 [10 3B 00 02 11]
-  CommandLcd(Bytes(0xC0, 0x10, 0x3B, 0x00, 0x02, 0x11)); // Panel Driving BGR for 1581 [10 3B 00 02 11]
-  CommandLcd(Bytes(0xC1, 0x10, 0x10, 0x88));             // Display Timing Normal [10 10 88]
-  CommandLcd(Bytes(0xC5, 0x03));                         // Frame Rate [03]
-  CommandLcd(Bytes(0xC6, 0x02));                         // Interface Control [02]
-
-//CommandLcd(Bytes(0xC8, 0x00, 0x32, 0x36, 0x45,         // Gamma settings
-//                 0x06, 0x16, 0x37, 0x75, 0x77,
-//                 0x54, 0x0C, 0x00));
+
+// Scheduling
 //
-  CommandLcd(Bytes(0x11));                               // Exit sleep mode.
-  delay(150);
-  CommandLcd(Bytes(0x29));                               // Display on.
-  CommandLcd(Bytes(0x20));                               // Exit invert mode.
-  CommandLcd(Bytes(0x36, 0x0A));                         // Default address mode. Sets BGR order and horiz flip.
-}
+// Timer 2 provides a 1ms tick. Each Cycle runs one slice of the most urgent
+// task that has work to do, in priority order:
+//
+//   AnimateTask - queue the next frame of a running effect, with any pings
+//   RadioTask   - queue changed colours for transmission
+//   EepromStep  - write a byte of a scene change (see scenes.h)
+//   ColourTask  - apply a knob turn to the strip colours, or a held turn or
+//                 long press to the selection
+//   PointerTask - redraw one changed span of a turned knob's pointer
+//   LabelTask   - with the pointers idle, redraw a changed knob label
+//   LinkTask    - redraw a line of the link table
+//   OverlayTask - with OVERLAY set, redraw a line of the probe table
+//
+// Until the screen is complete BootTask takes the place of the three knob
+// tasks.
+//
+// Radio SPI transfers are clocked out by the SPI interrupt (see
+// wireless.h), so they proceed while the main loop renders. The IRQ pin is
+// not wired, so each Cycle starts with RfPoll, which reads STATUS while
+// packets are being sent. A send is therefore seen complete within one
+// slice of finishing.
+//
+// A pointer slice writes at most one span, so a colour change waits at most
+// one slice before being sent, unless the radio is still blanking after its
+// previous transmission.
+//
+// Each Cycle, and each task that does work, is timed by a probe (see
+// probe.h).
 
+volatile u16 ticks;  // Milliseconds since timer 2 started
 
-#include "ui.h"
-#include "wireless.h"
+ISR(TIMER2_COMPA_vect) {ticks++;}
 
+u16 Ticks() {u8 sreg = SREG; cli(); u16 t = ticks; SREG = sreg; return t;}
 
-ISR(PCINT0_vect)     {PinChangeInterrupt();}
-ISR(BADISR_vect)     {}
-ISR(TIMER0_OVF_vect) {Timer0Interrupt();}
+u8 Due(u16 at) {return (s16)(Ticks() - at) >= 0;}
+
+
+// Boot
+//
+// The ILI9481 and nRF24L01+ need about 270ms and 110ms of reset and power up
+// waits. Rather than delay through them one after the other, each device's
+// initialisation is run a step at a time by BootTask, a step being due once
+// the wait returned by the one before has passed. The radio's waits overlap
+// the LCD's, and once the radio is ready every strip is marked for update,
+// so that RadioTask sends the colours while the screen is still being set up.
+// Drawing the screen follows the LCD's initialisation as further steps.
+//
+// bootpacket and bootready record the ticks since reset at which the first
+// colour packet was queued and at which the knobs became usable. Read them
+// with dwdebug, or on the last line of the probe overlay (make OVERLAY=1).
+
+#define LCDSTEPS (INITLCDSTEPS + INITSCREENSTEPS)
+
+u8  lcdstep, rfstep;  // Next step of each device
+u16 lcdat, rfat;      // Tick at which it is due
+u16 bootpacket;       // Tick at which the first colour packet was queued
+u16 bootready;        // Tick at which the screen was complete
+
+
+// Colour changes are sent at most every GLIDE ms, each as a fade lasting
+// until the next could arrive, so that the strips move smoothly between knob
+// readings. GLIDE also covers the radio noise caused by the strips updating
+// after a transmission (about 10ms).
+//
+// The changed strips are sent one broadcast, which is not acknowledged.
+// Every PINGPERIOD ms one strip in turn is sent its colour in a packet of
+// its own, which is acknowledged with the strip's telemetry (see Links in
+// wireless.h) and restores a colour the strip missed. A strip whose own
+// packet failed through all the nRF24L01+'s retries is left out of the
+// broadcasts and sent its own packet at every GLIDE, until one is
+// acknowledged.
+
+#define GLIDE      100  // ms
+#define FRAME       20  // ms per ledstrip fade frame
+#define PINGPERIOD 200  // ms, so each strip is heard from in every LINKPERIOD
 
 u8 update[4]  = {0}; // Strips updated
 u8 colours[4][4] = {  // colours[ledstrip][colourindex]
-  {0, 0, 0, 20}, // Strip 0 '15925'
-  {0, 0, 0, 20}, // Strip 1 '25925'
-  {0, 0, 0, 20}, // Strip 2 '35925'
-  {0, 0, 0, 20}  // Strip 3 '45925'
+  {0, 0, 0, 20}, // Strip 0
+  {0, 0, 0, 20}, // Strip 1
+  {0, 0, 0, 20}, // Strip 2
+  {0, 0, 0, 20}  // Strip 3
 };
-s8 destination = -1;  // ledstrip for which transmission is underway, -1 otherwise
 
+u16 quietat;          // Tick at which the next colour packet may be sent
+u16 updatedat[4];     // Tick at which each strip's pending update was made
+u16 latency;          // ms from colour change to transmission, oldest in most recent packet
+u16 maxlatency;       // ms from colour change to transmission, worst seen
+u8  pingstrip;        // Strip next sent its own packet
+u16 pingat;           // Tick at which it is due
 
-void CheckSendStatus() {
-  u8 status = 0;
-  if (destination >= 0) if ((status = RfStatus()) & 0x30) {
-    if (status & 0x10) WriteRfCmd(FLUSH_TX); // Flush FIFO if not already written
-    WriteRfReg(STATUS, 0x70);     // Clear all three interrupt flags
-    destination = -1;
-  }
+
+u8 OwnStrips() { // Strips to be sent their own packet: those that failed, and any due a ping
+  u8 own = RfFailed();
+  if (Due(pingat)) {own |= 1<<pingstrip;  pingstrip = (pingstrip+1) & 3;  pingat = Ticks() + PINGPERIOD;}
+  return own;
 }
 
-void CheckUpdate() {
-  for (u8 i=0; i<1 /*countof(update)*/; i++) {
+u8 CheckUpdate() { // Returns whether a packet was queued
+  u8 packet[PAYLOAD] = {MSGFADE, 0};
+  u16 now = Ticks();
+  u8 own = OwnStrips();
+  latency = 0;
+  for (u8 i=0; i<countof(update); i++) {
+    for (u8 j=0; j<4; j++) packet[2+4*i+j] = colours[i][j];
     if (update[i]) {
-      destination = i;
-      RfWrite(i, colours[i]);
+      packet[1] |= 1<<i;
       update[i] = 0;
-      break;
+      if ((u16)(now - updatedat[i]) > latency) latency = now - updatedat[i];
     }
   }
-  delay(10); // Delay during radio noise caused by update of led strips
+  if (latency > maxlatency) maxlatency = latency;
+  u8 dirty = packet[1];
+  if (!dirty  &&  !own) return 0;
+  packet[18] = GLIDE/FRAME;  // Frames, low byte first
+  packet[1]  = dirty & ~own;
+  if (packet[1]) RfWrite(BROADCAST, packet);
+  for (u8 i=0; i<countof(update); i++) if (own & 1<<i) {packet[1] = 1<<i;  RfWrite(STRIP(i), packet);}
+  if (!bootpacket) bootpacket = now;
+  quietat = now + GLIDE;
+  return 1;
 }
 
 void SetColour(u8 knob) {
+  u16 step = knobs[knob].nextstep;
+  knobs[knob].colourstep = step;
   for (int strip=0; strip<4; strip++) {
-    colours[strip][knob] = knobs[knob].nextstep;
+    colours[strip][knob] = step;
+    if (!update[strip]) updatedat[strip] = Ticks();
     update[strip] = 1;
   }
 }
 
-void Cycle() {
-  if (destination < 0) CheckUpdate(); else CheckSendStatus();
-  for (int knob=0; knob<4; knob++) {
-    if (knobs[knob].curstep != knobs[knob].nextstep) {
+// Scenes (see scenes.h)
+//
+// StoreScene saves the colours as a scene, here and on the strips.
+// RecallScene sends only the scene's number, each strip fading to its own
+// copy, and loads the controller's copy. ShowColours then moves the knobs
+// to strip 0's colours without sending them again. The scene last stored or
+// recalled is loaded before the radio starts, so that the colours sent at
+// boot are the scene the strips have restored. Both are bound to the knob's
+// switch (see Selection below).
+
+void ShowColours() {
+  for (u8 knob=0; knob<4; knob++) knobs[knob].nextstep = knobs[knob].colourstep = colours[0][knob];
+}
+
+u8 StoreScene(u8 scene) { // Returns 0 if the radio queue is full
+  u8 packet[PAYLOAD] = {MSGSTORE, 0x0F};
+  for (u8 i=0; i<4; i++) for (u8 j=0; j<4; j++) packet[2+4*i+j] = colours[i][j];
+  packet[18] = scene;
+  if (!RfWrite(BROADCAST, packet)) return 0;
+  SaveScene(scene, colours[0]);
+  return 1;
+}
+
+u8 RecallScene(u8 scene) { // Returns 0 if never stored or the radio queue is full
+  u8 packet[PAYLOAD] = {MSGRECALL, 0x0F, scene, GLIDE/FRAME};
+  u8 loaded[4][4];
+  if (!LoadScene(scene, loaded[0])  ||  !RfWrite(BROADCAST, packet)) return 0;
+  for (u8 i=0; i<4; i++) for (u8 j=0; j<4; j++) colours[i][j] = loaded[i][j];
+  LogScene(scene);
+  for (u8 i=0; i<countof(update); i++) update[i] = 0;  // Superseded
+  ShowColours();
+  return 1;
+}
+
+// Effects (see effects.h)
+//
+// While an effect runs, AnimateTask draws a frame of it from colours[][]
+// every EFFECTFRAME ms and broadcasts it as MSGCOLOURS, 100 packets/s. Each
+// frame is due EFFECTFRAME ms after the one before was due, and moves the
+// phase on by the same step, so the effect keeps its rate whatever the
+// other tasks do. AnimateTask comes first in each Cycle, so a frame waits
+// at most one slice of another task. Frames that fall due during a long
+// slice are then sent back to back, pipelined into the nRF24L01+'s TX FIFO
+// (see wireless.h). No more than EFFECTBURST are sent so, as many as the
+// TX FIFO and each strip's RX FIFO hold; any further behind are skipped,
+// and counted in effectskipped.
+//
+// The knobs still set colours[][], shown from the next frame, but RadioTask
+// sends nothing while an effect runs. Instead, when a ping is due and the
+// radio queue is empty, the frame goes to the pinged strip and any whose
+// last packet failed in packets of their own, and to the rest as the
+// broadcast, so that the link table stays current and failed strips are
+// retried every PINGPERIOD. StopEffect marks every strip for update, so
+// that they glide back to the steady colours.
+
+#ifndef EFFECT
+#define EFFECT 0            // make EFFECT=n runs effect n from power up
+#endif
+
+#define EFFECTFRAME  10     // ms per frame
+#define EFFECTBURST  3      // Frames sent back to back to catch up
+#define EFFECTPERIOD 4000   // ms per cycle of an effect
+
+u8  effect = EFFECTNONE;
+u16 effectphase;            // Phase of the next frame
+u16 effectstep;             // Phase advance per frame
+u16 effectat;               // Tick at which the next frame is due
+u16 effectframes;           // Frames sent
+u16 effectskipped;          // Frames skipped, too far behind to catch up
+
+void StartEffect(u8 e, u16 period) { // Period in ms, at least EFFECTFRAME
+  effect      = e;
+  effectphase = 0;
+  effectstep  = 65536UL * EFFECTFRAME / period;
+  effectat    = Ticks();
+}
+
+void StopEffect() {
+  effect = EFFECTNONE;
+  for (u8 i=0; i<countof(update); i++) {update[i] = 1;  updatedat[i] = Ticks();}
+}
+
+
+// Selection
+//
+// Turning the knob with its switch held (see knobs.h) steps through the
+// effects and then the scenes, each detent to the next, and round from the
+// last scene to no effect. Stepping onto a scene stops any effect and
+// recalls the scene, if it was ever stored. Holding the switch for HOLDMS
+// without turning stores the colours as the scene selected, or as the last
+// scene if an effect is selected.
+
+#define SELECTIONS (EFFECTS + SCENES)  // Effects first, EFFECTNONE at 0
+
+u8 selection;
+
+void Select(s8 turn) { // Detents from the current selection
+  selection = (selection + SELECTIONS + turn % SELECTIONS) % SELECTIONS;
+  if (selection < EFFECTS) {
+    if (selection == effect) return;
+    if (selection) StartEffect(selection, EFFECTPERIOD);  else StopEffect();
+  } else {
+    if (effect) StopEffect();
+    RecallScene(selection - EFFECTS);
+  }
+}
+
+void StoreSelected() {
+  if (selection < EFFECTS) selection = EFFECTS + (lastscene != NOSCENE ? lastscene : 0);
+  StoreScene(selection - EFFECTS);
+}
+
+u8 AnimateTask() { // Returns whether a frame was queued
+  if (!effect  ||  rfstep < INITWIRELESSSTEPS  ||  !Due(effectat)  ||  TxQueued() >= TXQUEUE) return 0;
+  u16 probe = ProbeStart();
+  u16 late = Ticks() - effectat;
+  if (late >= EFFECTBURST*EFFECTFRAME) {
+    u16 missed = late/EFFECTFRAME - (EFFECTBURST-1);
+    effectat      += missed * EFFECTFRAME;
+    effectphase   += missed * effectstep;
+    effectskipped += missed;
+  }
+  u8 packet[PAYLOAD];
+  EffectFrame(effect, effectphase, colours, packet);
+  u8 own = Due(pingat)  &&  !TxQueued() ? OwnStrips() : 0;  // At most 4 packets, so all fit
+  packet[1] = 0x0F & ~own;
+  if (packet[1]) RfWrite(BROADCAST, packet);
+  for (u8 i=0; i<4; i++) if (own & 1<<i) {packet[1] = 1<<i;  RfWrite(STRIP(i), packet);}
+  effectat    += EFFECTFRAME;
+  effectphase += effectstep;
+  effectframes++;
+  ProbeEnd(PROBEEFFECT, probe);
+  return 1;
+}
+
+u8 RadioTask() {
+  if (effect  ||  rfstep < INITWIRELESSSTEPS  ||  !RfIdle()) return 0;
+  if ((s16)(Ticks() - quietat) < 0) return 0;
+  u16 probe = ProbeStart();
+  if (!CheckUpdate()) return 0;
+  ProbeEnd(PROBERADIO, probe);
+  return 1;
+}
+
+u8 BootTask() { // Returns whether a step was run
+  // The LCD goes first: its step 0 sets up port B before the radio's
+  if (lcdstep < LCDSTEPS  &&  Due(lcdat)) {
+    u8 wait = 0;
+    if (lcdstep < INITLCDSTEPS) wait = InitLCDStep(lcdstep);
+    else                        InitscreenStep(lcdstep - INITLCDSTEPS);
+    lcdat = Ticks() + wait + 1;  // The current tick may be about to end
+    if (++lcdstep == LCDSTEPS) {bootready = Ticks();  ProbeClear();  ShowColours();}
+    return 1;
+  }
+  if (rfstep < INITWIRELESSSTEPS  &&  Due(rfat)) {
+    rfat = Ticks() + InitWirelessStep(rfstep) + 1;
+    if (++rfstep == INITWIRELESSSTEPS) {
+      for (u8 i=0; i<countof(update); i++) {update[i] = 1;  updatedat[i] = Ticks();}
+    }
+    return 1;
+  }
+  return 0;
+}
+
+u8 ColourTask() {
+  u16 probe = ProbeStart();
+  ReadKnobs();
+  if (heldturn  ||  LongPress()) {
+    if (heldturn) Select(heldturn);  else StoreSelected();
+    heldturn = 0;
+    ProbeEnd(PROBECOLOUR, probe);
+    return 1;
+  }
+  for (u8 knob=0; knob<4; knob++) {
+    if (knobs[knob].colourstep != knobs[knob].nextstep) {
       SetColour(knob);
-      UpdatePointer(&knobs[knob]);
+      ProbeEnd(PROBECOLOUR, probe);
+      return 1;
     }
   }
+  return 0;
+}
+
+u8 PointerTask() {
+  u16 probe = ProbeStart();
+  if (!drawknob) {
+    for (u8 knob=0; knob<4; knob++) {
+      if (knobs[knob].curstep != knobs[knob].nextstep) {StartPointer(&knobs[knob]); break;}
+    }
+  }
+  if (!PointerSlice()) return 0;
+  ProbeEnd(PROBESLICE, probe);
+  return 1;
+}
+
+u8 LabelTask() {
+  for (u8 knob=0; knob<4; knob++) {
+    if (knobs[knob].labelstep != knobs[knob].curstep) {DrawLabel(&knobs[knob]);  return 1;}
+  }
+  return 0;
+}
+
+
+void Decimal(char *s, u16 n) { // Right aligned in 6 characters
+  for (u8 i=6; i--; ) {s[i] = n  ||  i == 5 ? '0' + n%10 : ' ';  n /= 10;}
+}
+
+
+// Link table
+//
+// LinkTask shows each strip's link at the bottom left of the screen, under
+// a heading, every LINKPERIOD ms, one line per Cycle: the percentage of
+// transmissions acknowledged over the period, blank if none were made, then
+// the telemetry from the strip's last acknowledgement, its sequence number,
+// refresh time in us and RX FIFO overflows (see Links in wireless.h).
+
+#define LINKX      4
+#define LINKY      (480 - 5*FONTH - 4)
+#define LINKPERIOD 1000  // ms
+#define LINKCHARS  30    // Strip, then quality, sequence, refresh and overflows, 6 characters each
+
+const char PROGMEM linkheading[LINKCHARS+1] = "STRIP   QUAL   SEQ FRAME  OVER";
+
+u8  linkline = 5;                  // Next line to draw: 0 is the heading, 5 when idle
+u16 linkat;                        // Tick at which the table is next drawn
+u16 linkattempts[4], linkacked[4]; // Counts as last drawn
+
+u8 LinkTask() {
+  if (linkline > 4) {
+    if (!Due(linkat)) return 0;
+    linkat = Ticks() + LINKPERIOD;
+    linkline = 0;
+  }
+  char line[LINKCHARS+1];
+  u8 i;
+  if (linkline == 0) {
+    for (i=0; i<=LINKCHARS; i++) line[i] = __LPM((FlashAddr)(linkheading+i));
+  } else {
+    u8 strip = linkline-1;
+    struct link l;
+    u8 sreg = SREG;  cli();  l = links[strip];  SREG = sreg;
+    u16 attempts = l.attempts - linkattempts[strip], acked = l.acked - linkacked[strip];
+    linkattempts[strip] = l.attempts;  linkacked[strip] = l.acked;
+    for (i=0; i<5; i++) line[i] = __LPM((FlashAddr)(linkheading+i));
+    line[5] = '0' + strip;
+    Decimal(line+6,  attempts ? (u32)acked*100 / attempts : 0);
+    if (!attempts) line[11] = ' ';
+    Decimal(line+12, l.telemetry[0]);
+    Decimal(line+18, l.telemetry[1] * 128);
+    Decimal(line+24, l.telemetry[2]);
+    line[LINKCHARS] = 0;
+  }
+  paint = WHITE;
+  RenderText(LINKX, LINKY + linkline*FONTH, font, line);
+  linkline++;
+  return 1;
+}
+
+
+#if OVERLAY
+
+// Probe overlay
+//
+// OverlayTask shows the probe table at the top left of the screen, under
+// a heading, every OVERLAYPERIOD ms. Being the least urgent task it draws
+// one line per Cycle, a RenderText call of about 1ms, which the CYCLE and
+// ALPHA probes include. Times are in us. Then come the boot times,
+// bootpacket and bootready, in ms, and the least free stack seen: main
+// paints the RAM between .bss and the stack with STACKPAINT, and StackFree
+// counts the painted bytes the stack has not yet reached.
+
+#define OVERLAYX      4
+#define OVERLAYY      24
+#define OVERLAYPERIOD 1000  // ms
+#define OVERLAYCHARS  30    // Name, then count, min, avg and max, 6 characters each
+
+const char PROGMEM overlayheading[OVERLAYCHARS+1] = "PROBE  COUNT   MIN   AVG   MAX";
+const char PROGMEM overlayboot[OVERLAYCHARS+1]    = "BOOT  PACKET       READY      ";
+const char PROGMEM overlaystack[OVERLAYCHARS+1]   = "STACK  FREE                   ";
+const char PROGMEM probenames[NPROBES][6] = {
+  "CYCLE", "RADIO", "SEND", "SPI", "COLOR", "SLICE", "PTR", "STEPS", "RING", "ALPHA", "FILL", "EFFCT"
+};
+
+u8  overlayline = NPROBES+3;  // Next line to draw: 0 is the heading, NPROBES+1 the boot times, NPROBES+2 the stack, NPROBES+3 when idle
+u16 overlayat;                // Tick at which the table is next drawn
+
+#define STACKPAINT 0xA5
+extern u8 __heap_start;  // End of .bss, from the linker
+
+void StackPaint() {  // Before interrupts are enabled
+  u8 *p = &__heap_start;
+  while (p < (u8*)SP - 16) *p++ = STACKPAINT;
+}
+
+u16 StackFree() {
+  u8 *p = &__heap_start;
+  while (*p == STACKPAINT) p++;
+  return p - &__heap_start;
+}
+
+u8 OverlayTask() {
+  if (overlayline > NPROBES+2) {
+    if (!Due(overlayat)) return 0;
+    overlayat = Ticks() + OVERLAYPERIOD;
+    overlayline = 0;
+  }
+  char line[OVERLAYCHARS+1];
+  u8 i;
+  if (overlayline == 0) {
+    for (i=0; i<=OVERLAYCHARS; i++) line[i] = __LPM((FlashAddr)(overlayheading+i));
+  } else if (overlayline == NPROBES+2) {
+    for (i=0; i<=OVERLAYCHARS; i++) line[i] = __LPM((FlashAddr)(overlaystack+i));
+    Decimal(line+12, StackFree());
+  } else if (overlayline > NPROBES) {
+    for (i=0; i<=OVERLAYCHARS; i++) line[i] = __LPM((FlashAddr)(overlayboot+i));
+    Decimal(line+12, bootpacket);
+    Decimal(line+24, bootready);
+  } else {
+    struct probe p;
+    u8 sreg = SREG;  cli();  p = probes[overlayline-1];  SREG = sreg;
+    for (i=0; i<6; i++) line[i] = __LPM((FlashAddr)(probenames[overlayline-1]+i));
+    for (i=0; i<6; i++) if (!line[i]) line[i] = ' ';
+    Decimal(line+6,  p.count);
+    Decimal(line+12, p.min);
+    Decimal(line+18, p.count ? p.sum / p.count : 0);
+    Decimal(line+24, p.max);
+    line[OVERLAYCHARS] = 0;
+  }
+  paint = WHITE;
+  RenderText(OVERLAYX, OVERLAYY + overlayline*FONTH, font, line);
+  overlayline++;
+  return 1;
+}
+
+#else
+
+u8 OverlayTask() {return 0;}
+void StackPaint() {}
+
+#endif
+
+
+void Slice() {
+  if (AnimateTask()) return;
+  if (RadioTask())   return;
+  if (BootTask())    return;
+  if (EepromStep())  return;
+  if (lcdstep < LCDSTEPS) return;  // Knobs not drawn yet
+  if (ColourTask())  return;
+  if (PointerTask()) return;
+  if (LabelTask())   return;
+  if (LinkTask())    return;
+  OverlayTask();
+}
+
+void Cycle() {
+  u16 probe = ProbeStart();
+  RfPoll();
+  Slice();
+  ProbeEnd(PROBECYCLE, probe);
 }
 
 
 int main() {
 
-  // Prepare timer counter 0 for use as 32ms debounce timer
+  StackPaint();
+
+  // Prepare timer counter 0 to time detents and as 32ms debounce timer
   TCCR0A = 0x00;  // Normal operation, count up, overflow at 0xFF.
   TCCR0B = 0x05;  // No output compare, divide processor clock by 1024.
-  TIMSK0 = 0x00;  // Initially do not generate timer interrupt.
+  TIMSK0 = 0x01;  // Interrupt on overflow only, until the switch is pressed.
+
+  // Prepare timer counter 2 for the 1ms scheduler tick
+  TCCR2A = 0x02;  // Clear timer on compare match with OCR2A.
+  TCCR2B = 0x04;  // Divide processor clock by 64 - 125 counts per ms.
+  OCR2A  = 124;   // Count 0..124.
+  TIMSK2 = 0x02;  // Interrupt on compare match A.
 
-  InitLCD();
+  // Timer counter 1 runs freely for the probes (see probe.h)
+  TCCR1A = 0x00;  // Normal operation, count up, overflow at 0xFFFF.
+  TCCR1B = 0x02;  // Divide processor clock by 8 - 1 count per us.
 
-  Initscreen();
+  // The last scene, if any, replaces the default colours
+  FindRing();
+  if (lastscene != NOSCENE) {LoadScene(lastscene, colours[0]);  selection = EFFECTS + lastscene;}
 
-  InitWireless();
+#if EFFECT
+  StartEffect(EFFECT, EFFECTPERIOD);
+  selection = EFFECT;
+#endif
 
   //sendLed(0x4, 0x4, 0x0, 0x20);
 
   //wirelessTest();
 
-  sei();
+  sei();  // Ticks pace BootTask, which Cycle runs until the screen is complete
 
   while (1) {Cycle();}
 
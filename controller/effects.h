@@ -0,0 +1,56 @@
+// Effects - animations of the four strips' colours, a frame at a time.
+//
+// An effect is drawn from colours[][], the colours set on the knobs, at a
+// phase through its cycle, 0 to 65535. EffectFrame fills a MSGCOLOURS
+// packet with every strip's levels for the phase, to sixteenths, so that
+// slow effects move smoothly:
+//
+//   EFFECTCHASE    each strip in turn lights at full, fading out as the
+//                  light moves over the next two, from strip 0 to strip 3
+//   EFFECTBREATHE  all strips brighten from dark to full and back, the
+//                  brightness squared so that the dim end lingers
+//   EFFECTCYCLE    each strip fades to the colour of the strip after it,
+//                  so that the four colours circle the strips
+//
+// Levels are worked in 8.8 fixed point, whole levels in the high byte. A
+// weight of 256 is full. Products are taken in u16: a level times 256 is
+// past the 16 bit int that u8s promote to on the AVR.
+//
+// The includer provides PAYLOAD and MSGCOLOURS (see wireless.h).
+
+#define EFFECTNONE    0
+#define EFFECTCHASE   1
+#define EFFECTBREATHE 2
+#define EFFECTCYCLE   3
+#define EFFECTS       4
+
+void PutLevel(u8 *packet, u8 strip, u8 channel, u16 level) { // Whole level and sixteenths, as MSGCOLOURS
+  packet[2+4*strip+channel] = level >> 8;
+  packet[20+2*strip+channel/2] |= channel & 1 ? (level >> 4 & 0x0F) : (level & 0xF0);
+}
+
+u16 Triangle(u16 phase) { // 0 up to 256 at half way, and back
+  u16 t = phase >> 7;
+  return t <= 256 ? t : 512 - t;
+}
+
+void EffectFrame(u8 effect, u16 phase, u8 colours[4][4], u8 *packet) { // PAYLOAD bytes
+  for (u8 i=0; i<PAYLOAD; i++) packet[i] = 0;
+  packet[0] = MSGCOLOURS;
+  packet[1] = 0x0F;
+  u16 at = phase >> 6;  // 256 per strip
+  u16 t = Triangle(phase), breath = (u32)t*t >> 8;
+  for (u8 strip=0; strip<4; strip++) {
+    u16 behind = (at - strip*256) & 1023;  // How far the chase has passed the strip
+    u16 weight = 256;
+    if (effect == EFFECTCHASE)   weight = behind < 512 ? 256 - (behind >> 1) : 0;
+    if (effect == EFFECTBREATHE) weight = breath;
+    u8 *from = colours[(strip + (at >> 8)) & 3], *to = colours[(strip + (at >> 8) + 1) & 3];
+    u8 along = at & 0xFF;
+    for (u8 channel=0; channel<4; channel++) {
+      u16 level = effect == EFFECTCYCLE ? (u16)from[channel] * (u16)(256 - along) + (u16)to[channel] * along
+                                        : (u16)colours[strip][channel] * weight;
+      PutLevel(packet, strip, channel, level);
+    }
+  }
+}
@@ -0,0 +1,57 @@
+// Gamma encoded channel maths - reference kernels.
+//
+// Channels are 6 bit values in square root (gamma encoded) space. These are
+// the definitions host/blendgen builds ui.h's blending tables from, and
+// against which host/blendtest checks the table driven BlendPixel and
+// AlphaMultiplyPixel.
+
+u8 u6sqrt(u16 n) {  // from 12 bit (0..4095) to 6 bit (0 .. 63)
+  u8 result;
+#ifdef __AVR__
+  // n is passed in rB:rA
+  // uses
+  //   r23 - mask
+  //   r22 - sqrt
+  //   r21 - check
+  asm(
+    "        ldi   r23,0x20       ; mask (sufficient for 0 <= n <= 4095) \n"
+    "        eor   r22,r22        ; sqrt                                 \n"
+    "                                                                    \n"
+    "isqr2:  mov   r21,r22        ; check = sqrt                         \n"
+    "        add   r21,r23        ; check += mask                        \n"
+    "        mul   r21,r21        ; r1:r0 = check*check                  \n"
+    "        cp    r0,%A1         ; compare check*check with parameter n \n"
+    "        cpc   r1,%B1                                                \n"
+    "        brcc  isqr4          ; if check*check > n                   \n"
+    "                                                                    \n"
+    "        mov   r22,r21        ; sqrt = check                         \n"
+    "                                                                    \n"
+    "isqr4:  lsr   r23            ; mask >>= 1                           \n"
+    "        brne  isqr2          ; loop if mask nonzero                 \n"
+    "                                                                    \n"
+    "        eor   r1,r1          ; restore r1==0 invariant              \n"
+    "        mov   %0,r22         ; return sqrt                          \n"
+  : "=r" (result)             // Result should be assigned to register %0
+  : "r"  (n)                  // Parameter will be found in registers %A1 and %B1
+  : "r21", "r22", "r23");
+#else
+  // Portable equivalent of the above: largest sqrt with sqrt*sqrt < n.
+  result = 0;
+  for (u8 mask = 0x20; mask; mask >>= 1) {
+    u8 check = result + mask;
+    if (check*check < n) result = check;
+  }
+#endif
+  return result;
+}
+
+u16 AlphaMultiplyChannel(u8 p, u8 a) { // reduce gamma encoded 6 bit pixel p by 6 bit linear gamma a.
+  return ((p*p)/4) * a;
+}
+
+
+//u16 AlphaMultiplyChannel(u8 level, u8 alpha) { // level in sqrt space, alpha and result in linear space
+//  u16 n1 = (alpha * level) / 2;     // 11 bit
+//  u16 n2 = (n1/2) * level;          // 16 bit
+//  return n1 + n2;                   // 16 bit
+//}
@@ -0,0 +1,165 @@
+// atlasgen - convert a PBM or PGM image of glyphs to an alpha map atlas
+// for ui.h's RenderText.
+//
+// Usage: atlasgen [-m] name gap chars image >name.h
+//
+// The image is a row of equal cells, one per character of chars, left to
+// right. PBM 1 bits are painted; PGM grey levels are coverage, maxval being
+// fully painted, so an image looks as it will on the black screen. Each
+// glyph is its cell with clear columns at the right removed, or the whole
+// cell with -m (monospaced) and for a cell that is all clear. RenderText
+// leaves gap clear columns after each glyph.
+//
+// Writes the atlas as the PROGMEM array name, laid out as described at
+// RenderText, with name's height as #define <NAME>H. Characters between
+// the lowest and highest of chars that are not in it share the lowest's
+// glyph, as RenderText does for those outside.
+
+#include <ctype.h>
+
+#include "avrhost.h"
+
+#define ALPHACLEAR 0x00
+#define ALPHASOLID 0x40
+#define ALPHAPART  0x80
+#define ALPHALONG  0xC0
+
+int  width, height;
+u8  *level;            // 0..15 per pixel
+
+u8   data[65536];
+int  ndata;
+
+int Token(FILE *f) { // Next number of an ASCII PNM header or raster, skipping comments
+  int c, n = 0;
+  while ((c = fgetc(f)) != EOF  &&  (isspace(c)  ||  c == '#')) if (c == '#') while ((c = fgetc(f)) != EOF  &&  c != '\n');
+  if (c == EOF  ||  !isdigit(c)) {fprintf(stderr, "atlasgen: bad image.\n"); exit(1);}
+  while (isdigit(c)) {n = n*10 + c - '0';  c = fgetc(f);}
+  return n;
+}
+
+int Bit(FILE *f) { // Next pixel of a P1 raster, whose digits need not be separated
+  int c;
+  while ((c = fgetc(f)) != EOF  &&  c != '0'  &&  c != '1') if (c == '#') while ((c = fgetc(f)) != EOF  &&  c != '\n');
+  if (c == EOF) {fprintf(stderr, "atlasgen: image ends early.\n"); exit(1);}
+  return c - '0';
+}
+
+void ReadImage(const char *name) {
+  FILE *f = fopen(name, "rb");
+  if (!f) {fprintf(stderr, "atlasgen: cannot read %s.\n", name); exit(1);}
+  if (fgetc(f) != 'P') {fprintf(stderr, "atlasgen: %s is not a PBM or PGM.\n", name); exit(1);}
+  int type = fgetc(f) - '0';
+  if (type != 1  &&  type != 2  &&  type != 4  &&  type != 5) {fprintf(stderr, "atlasgen: %s is not a PBM or PGM.\n", name); exit(1);}
+  width  = Token(f);
+  height = Token(f);
+  int maxval = type == 1  ||  type == 4 ? 1 : Token(f);
+  if (maxval < 1  ||  maxval > 255) {fprintf(stderr, "atlasgen: %s has maxval %d.\n", name, maxval); exit(1);}
+  level = malloc(width * height);
+  int byte = 0, bits = 0;
+  for (int i=0; i<width*height; i++) {
+    int v;
+    switch (type) {
+      case 1:  v = Bit(f);  break;
+      case 2:  v = Token(f);  break;
+      case 4:  if (i % width == 0) bits = 0;  // Rows are padded to whole bytes
+               if (!bits) {byte = fgetc(f);  bits = 8;}
+               v = byte == EOF ? EOF : byte >> --bits & 1;
+               break;
+      default: v = fgetc(f);  break;
+    }
+    if (v == EOF) {fprintf(stderr, "atlasgen: %s ends early.\n", name); exit(1);}
+    level[i] = (v * 15 + maxval/2) / maxval;
+  }
+  fclose(f);
+}
+
+// Glyph encoding: the glyph's pixels row after row as codes of
+//
+//   00nnnnnn              n+1 clear pixels
+//   01nnnnnn              n+1 solid pixels
+//   10nnnnnn a a ...      n+1 partial alphas, 4 bits each, high nibble first
+//   11snnnnn nnnnnnnn     n+1 clear (s 0) or solid (s 1) pixels, up to 8192
+
+void Run(int op, int n) {
+  while (n > 0) {
+    int len = n > 8192 ? 8192 : n;
+    if (len > 64) {data[ndata++] = ALPHALONG | (op == ALPHASOLID ? 0x20 : 0) | (len-1) >> 8;  data[ndata++] = (len-1) & 0xFF;}
+    else           data[ndata++] = op | (len-1);
+    n -= len;
+  }
+}
+
+void Partials(const u8 *alpha, int n) {
+  while (n > 0) {
+    int len = n > 64 ? 64 : n;
+    data[ndata++] = ALPHAPART | (len-1);
+    for (int i=0; i<len; i+=2) data[ndata++] = alpha[i] << 4 | (i+1 < len ? alpha[i+1] : 0);
+    alpha += len;  n -= len;
+  }
+}
+
+void Encode(int x0, int w) { // Cell columns x0..x0+w-1
+  u8  pixels[w*height];
+  int n = 0, i, j;
+  for (int y=0; y<height; y++) for (int x=x0; x<x0+w; x++) pixels[n++] = level[y*width + x];
+  for (i=0; i<n; i=j) {
+    u8 a = pixels[i];
+    if (a == 0  ||  a == 15) {
+      for (j=i; j<n  &&  pixels[j] == a; j++);
+      Run(a ? ALPHASOLID : ALPHACLEAR, j-i);
+    } else {
+      for (j=i; j<n  &&  pixels[j] != 0  &&  pixels[j] != 15; j++);
+      Partials(pixels+i, j-i);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  int mono = argc > 1  &&  !strcmp(argv[1], "-m");
+  if (argc != 5 + mono) {fprintf(stderr, "Usage: atlasgen [-m] name gap chars image\n"); return 2;}
+  const char *name = argv[1+mono], *chars = argv[3+mono];
+  int gap = atoi(argv[2+mono]), nchars = strlen(chars);
+  ReadImage(argv[4+mono]);
+  if (!nchars  ||  width % nchars) {fprintf(stderr, "atlasgen: image width %d is not %d cells.\n", width, nchars); return 1;}
+  int cell = width / nchars;
+  if (cell > 255  ||  height > 255) {fprintf(stderr, "atlasgen: cells are over 255 pixels.\n"); return 1;}
+
+  u8 first = 255, last = 0;
+  for (int c=0; c<nchars; c++) {
+    if ((u8)chars[c] < first) first = chars[c];
+    if ((u8)chars[c] > last)  last  = chars[c];
+  }
+  int count = last - first + 1, header = 4 + 3*count;
+  int offset[256], glyphw[256];
+
+  for (int c=0; c<nchars; c++) {
+    int w = cell;
+    if (!mono) {
+      while (w > 0) {int y;  for (y=0; y<height  &&  !level[y*width + c*cell + w-1]; y++);  if (y < height) break;  w--;}
+      if (!w) w = cell;
+    }
+    offset[c] = header + ndata;  glyphw[c] = w;
+    Encode(c*cell, w);
+  }
+
+  char upper[64];
+  int i;
+  for (i=0; name[i]  &&  i < 63; i++) upper[i] = toupper(name[i]);
+  upper[i] = 0;
+
+  fprintf(stdout, "// Generated by host/atlasgen from %s - do not edit.\n\n", argv[4+mono]);
+  fprintf(stdout, "#define %sH %d\n\n", upper, height);
+  fprintf(stdout, "const u8 PROGMEM %s[%d] = {\n", name, header + ndata);
+  fprintf(stdout, "  %d, %d, %d, %d,  // Height, gap, first character, count\n", height, gap, first, count);
+  for (int ch=first; ch<=last; ch++) {
+    const char *at = strchr(chars, ch);
+    int c = (at ? at : strchr(chars, first)) - chars;
+    fprintf(stdout, "  0x%02X, 0x%02X, %2d,  // ", offset[c] & 0xFF, offset[c] >> 8, glyphw[c]);
+    fprintf(stdout, isprint(ch)  &&  ch != '\\' ? "'%c'%s\n" : "%d%s\n", ch, at ? "" : ", absent");
+  }
+  for (int j=0; j<ndata; j++) fprintf(stdout, "%s0x%02X,%s", j%16 ? " " : "  ", data[j], j%16 == 15 || j == ndata-1 ? "\n" : "");
+  fprintf(stdout, "};\n");
+
+  return 0;
+}
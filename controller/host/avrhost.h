@@ -0,0 +1,42 @@
+// Host (Linux) stand-ins for the AVR definitions ui.h relies on, so that
+// ui.h can be compiled with the native gcc against an emulated panel.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef VERBOSE
+#define printf(...)  // As on the device, ui.h's printf's are silent by default
+#endif
+
+#define countof(a) (sizeof(a)/sizeof(0[a]))
+
+typedef uint8_t   u8;   typedef int8_t    s8;
+typedef uint16_t  u16;  typedef int16_t   s16;
+typedef uint32_t  u32;
+
+typedef uintptr_t FlashAddr;   // Flash is ordinary memory on the host
+
+#define PROGMEM
+#define __LPM(a)      (*(const u8*)(a))
+#define __LPM_word(a) ((u16)(__LPM(a) | (__LPM((a)+1) << 8)))
+
+// I/O registers used by ui.h's knob handling, as plain variables
+u8 PINB, TIFR0, TCNT0, TIMSK0, OCR0A;
+
+// Timer 1 as read by the probes. It stands still, so every probe reads 0.
+u16 TCNT1;
+
+// I/O registers used by wireless.h. SPIF always reads as set, so every SPI
+// transfer completes at once. (SPI2X shares its bit so that InitWireless
+// selecting double speed leaves it set.)
+u8 PORTB, DDRB, SPCR, SPSR = 0x80, SPDR, SREG;
+#define SPIF  7
+#define SPI2X 7
+#define SPE   6
+#define MSTR  4
+#define SPIE  7
+#define cli()
+
+#include "../probe.h"
@@ -0,0 +1,18 @@
+// blendgen - generate blendtables.h, the gamma blending tables used by ui.h.
+
+#include "avrhost.h"
+#include "../gamma.h"
+
+int main() {
+  fprintf(stdout, "// Generated by host/blendgen from gamma.h - do not edit.\n\n");
+
+  fprintf(stdout, "const u16 PROGMEM squares[64] = {  // AlphaMultiplyChannel(p, 1)\n");
+  for (int p=0; p<64; p++) fprintf(stdout, "%s%3d,%s", p%16 ? " " : "  ", AlphaMultiplyChannel(p, 1), p%16 == 15 ? "\n" : "");
+  fprintf(stdout, "};\n\n");
+
+  fprintf(stdout, "const u8 PROGMEM sqrt12[4096] = {  // u6sqrt(n)\n");
+  for (int n=0; n<4096; n++) fprintf(stdout, "%s%2d,%s", n%32 ? " " : "  ", u6sqrt(n), n%32 == 31 ? "\n" : "");
+  fprintf(stdout, "};\n");
+
+  return 0;
+}
@@ -0,0 +1,67 @@
+// blendtest - check ui.h's table driven blending against the reference maths.
+//
+// The Ref functions are BlendPixel and AlphaMultiplyPixel as written before
+// the tables, computed with gamma.h's u6sqrt and AlphaMultiplyChannel.
+// Results must be bit-identical, and so must the ramp cache's.
+
+#include "avrhost.h"
+#include "lcdemu.h"
+#include "../ui.h"
+
+u16 RefAlphaMultiplyPixel(u16 pixel, u8 alpha) {
+  if (alpha >= 63) return pixel;
+  return
+    ((u6sqrt(AlphaMultiplyChannel((pixel >> 10) & 0x3E, alpha) >> 4) & 0x3E) << 10)
+  | ( u6sqrt(AlphaMultiplyChannel((pixel >>  5) & 0x3F, alpha) >> 4)         << 5)
+  | ( u6sqrt(AlphaMultiplyChannel((pixel <<  1) & 0x3E, alpha) >> 4)         >> 1);
+}
+
+u8 RefBlendChannel(u8 fg, u8 bg, u8 alpha) {
+  return u6sqrt((AlphaMultiplyChannel(fg, alpha) + AlphaMultiplyChannel(bg, 63-alpha)) >> 4);
+}
+
+u16 RefBlendPixel(u16 fg, u16 bg, u8 alpha) {
+  if (bg == 0) return RefAlphaMultiplyPixel(fg, alpha);
+  if (alpha >= 63) return fg;
+  if (alpha == 0)  return bg;
+  return
+    ((RefBlendChannel((fg>>10) & 0x3e,  (bg>>10) & 0x3e,  alpha) &0x3e)  << 10)
+  | ( RefBlendChannel((fg>> 5) & 0x3f,  (bg>> 5) & 0x3f,  alpha       )  << 5)
+  | ( RefBlendChannel((fg<< 1) & 0x3e,  (bg<< 1) & 0x3e,  alpha       )  >> 1);
+}
+
+u16 Grey(u8 c) {return ((c>>1) << 11) | (c << 5) | (c>>1);} // 6 bit level in all channels
+
+int failures;
+
+void Check(const char *name, u16 fg, u16 bg, u8 alpha, u16 got, u16 want) {
+  if (got == want) return;
+  if (failures++ < 10) fprintf(stderr, "%s(%04x, %04x, %d) = %04x, expected %04x.\n", name, fg, bg, alpha, got, want);
+}
+
+int main() {
+  // Every pixel at every alpha
+  for (u32 p=0; p<65536; p++) for (u8 a=0; a<64; a++)
+    Check("AlphaMultiplyPixel", p, 0, a, AlphaMultiplyPixel(p, a), RefAlphaMultiplyPixel(p, a));
+
+  // Every fg/bg/alpha channel triple, in all three channels at once
+  for (u8 f=0; f<64; f++) for (u8 b=0; b<64; b++) for (u8 a=0; a<64; a++)
+    Check("BlendPixel", Grey(f), Grey(b), a, BlendPixel(Grey(f), Grey(b), a), RefBlendPixel(Grey(f), Grey(b), a));
+
+  // And a spread of arbitrary pixel pairs
+  srand(1);
+  for (u32 i=0; i<1000000; i++) {
+    u16 f = rand(), b = rand();  u8 a = rand() % 64;
+    Check("BlendPixel", f, b, a, BlendPixel(f, b, a), RefBlendPixel(f, b, a));
+  }
+
+  // The ramp cache, switching pairs and filling levels out of order
+  for (u32 i=0; i<100000; i++) {
+    u16 f = rand() % 4 * 0x1234, b = rand() % 3 * 0x0841;  u8 a = rand() % 70;
+    Check("Ramp", f, b, a, Ramp(f, b, a), RefBlendPixel(f, b, a));
+  }
+
+  if (failures) {fprintf(stderr, "blendtest: %d failures.\n", failures); return 1;}
+  fprintf(stdout, "blendtest: table driven blending matches reference maths.\n");
+  return 0;
+}
@@ -0,0 +1,91 @@
+// effecttest - draw effects.h's frames on the host and check the levels
+// they send, to the sixteenth.
+//
+//   packet       frames are MSGCOLOURS to all four strips
+//   breathe      dark at the start of the cycle, a sixteenth of the colours
+//                a quarter through, and the colours themselves half way
+//   chase        the light on strip 0 at the start, fading on strip 3
+//                behind it, and on strip 1 a quarter through
+//   cycle        each strip's own colour at the start, half way to the
+//                next strip's an eighth through, and the next strip's a
+//                quarter through
+//   smooth       breathe and cycle move no level more than SMOOTH between
+//                frames at controller.c's power up rate
+
+#include "avrhost.h"
+
+void delay(int ms) {(void)ms;}
+
+#include "../wireless.h"
+#include "../effects.h"
+
+#define STEP   (65536L * 10 / 4000)   // EFFECTFRAME and EFFECTPERIOD
+#define SMOOTH (5*256)                // 8.8
+
+u8 colours[4][4] = {
+  {255,   0,   0,  20},
+  {  0, 200,  10,   0},
+  { 40,  40, 160,   0},
+  {  0,   0,   0, 255}
+};
+
+int failures;
+
+void Check(const char *name, int got, int want) {
+  if (got == want) return;
+  if (failures++ < 10) fprintf(stderr, "%s: %d, expected %d.\n", name, got, want);
+}
+
+u16 Level(const u8 *packet, u8 strip, u8 channel) { // 8.8, to the sixteenth
+  u8 fine = packet[20+2*strip+channel/2];
+  return packet[2+4*strip+channel] << 8 | (channel & 1 ? fine & 0x0F : fine >> 4) << 4;
+}
+
+void Expect(const char *name, u8 effect, u16 phase, u16 (*want)(u8 strip, u8 channel)) {
+  u8 packet[PAYLOAD];
+  EffectFrame(effect, phase, colours, packet);
+  for (u8 s=0; s<4; s++) for (u8 c=0; c<4; c++) Check(name, Level(packet, s, c), want(s, c) & 0xFFF0);
+}
+
+u16 Dark(u8 s, u8 c)         {(void)s; (void)c;  return 0;}
+u16 Full(u8 s, u8 c)         {return colours[s][c] << 8;}
+u16 Quarter(u8 s, u8 c)      {return colours[s][c] << 6;}
+u16 ChaseStart(u8 s, u8 c)   {return s == 0 ? colours[s][c] << 8 : s == 3 ? colours[s][c] << 7 : 0;}
+u16 ChaseQuarter(u8 s, u8 c) {return s == 1 ? colours[s][c] << 8 : s == 0 ? colours[s][c] << 7 : 0;}
+u16 Halfway(u8 s, u8 c)      {return (colours[s][c] + colours[(s+1)&3][c]) << 7;}
+u16 Next(u8 s, u8 c)         {return colours[(s+1)&3][c] << 8;}
+
+int main() {
+  u8 packet[PAYLOAD];
+  EffectFrame(EFFECTBREATHE, 0x1234, colours, packet);
+  Check("packet type", packet[0], MSGCOLOURS);
+  Check("packet strips", packet[1], 0x0F);
+  Check("packet sequence", packet[SEQUENCE], 0);
+
+  Expect("breathe start",    EFFECTBREATHE, 0,      Dark);
+  Expect("breathe quarter",  EFFECTBREATHE, 0x4000, Quarter);
+  Expect("breathe half",     EFFECTBREATHE, 0x8000, Full);
+  Expect("chase start",      EFFECTCHASE,   0,      ChaseStart);
+  Expect("chase quarter",    EFFECTCHASE,   0x4000, ChaseQuarter);
+  Expect("cycle start",      EFFECTCYCLE,   0,      Full);
+  Expect("cycle eighth",     EFFECTCYCLE,   0x2000, Halfway);
+  Expect("cycle quarter",    EFFECTCYCLE,   0x4000, Next);
+
+  u8 effects[] = {EFFECTBREATHE, EFFECTCYCLE};
+  for (u8 e=0; e<countof(effects); e++) {
+    u8 last[PAYLOAD];
+    EffectFrame(effects[e], 0, colours, last);
+    for (u32 phase=STEP; phase<=0x10000; phase+=STEP) {
+      EffectFrame(effects[e], phase, colours, packet);
+      for (u8 s=0; s<4; s++) for (u8 c=0; c<4; c++) {
+        int change = abs(Level(packet, s, c) - Level(last, s, c));
+        if (change > SMOOTH) Check(effects[e] == EFFECTBREATHE ? "breathe smooth" : "cycle smooth", change, SMOOTH);
+      }
+      memcpy(last, packet, sizeof packet);
+    }
+  }
+
+  if (failures) {fprintf(stderr, "effecttest: %d failures.\n", failures); return 1;}
+  fprintf(stdout, "effecttest: effect frames drawn as expected.\n");
+  return 0;
+}
@@ -0,0 +1,243 @@
+// kerneltest - check ui.h's maths kernels on the host against reference
+// results, exhaustively where the input space allows.
+//
+//   u6sqrt              every 12 bit input, against its definition
+//   Sqrt12              every 12 bit input, against u6sqrt
+//   SquareChannel       every channel level, against AlphaMultiplyChannel
+//   BlendChannel        every fg/bg/alpha triple, against gamma.h
+//   Sine, GetVec        every step, against the C library
+//   PlotHollowCircle    ring coverage and symmetry, radii 9..60
+//   scale               ticks lit along their lines and clear between them
+//   PlotPartLine        every pointer step, pixels against the ideal line
+//   Coverage            ring, tick and line alpha, within a level of dividing
+//   RenderText          font.h against font5x7.pbm, icons.h against am1, and
+//                       a made up atlas with long runs and odd partials
+
+#include <math.h>
+
+#include "avrhost.h"
+#include "lcdemu.h"
+#define PLOTLINE 1  // ui.h's line plotter, for the pointers
+#include "../ui.h"
+#include "../font.h"
+#include "../icons.h"
+
+int failures;
+
+void Fail(const char *format, int a, int b, int c, int d) {
+  if (failures++ < 10) {fprintf(stderr, format, a, b, c, d); fputc('\n', stderr);}
+}
+
+void Clear() {memset(framebuffer, 0, sizeof framebuffer);}
+
+void Sqrt() {
+  for (u16 n=0; n<4096; n++) {
+    u8 want = 0;
+    while (want < 63  &&  (want+1)*(want+1) < n) want++;
+    if (u6sqrt(n) != want) Fail("u6sqrt(%d) = %d, expected %d.", n, u6sqrt(n), want, 0);
+    if (Sqrt12(n) != want) Fail("Sqrt12(%d) = %d, expected %d.", n, Sqrt12(n), want, 0);
+  }
+  for (u8 p=0; p<64; p++)
+    if (SquareChannel(p) != AlphaMultiplyChannel(p, 1)) Fail("SquareChannel(%d) = %d, expected %d.", p, SquareChannel(p), AlphaMultiplyChannel(p, 1), 0);
+  for (u8 f=0; f<64; f++) for (u8 b=0; b<64; b++) for (u8 a=0; a<64; a++) {
+    u8 want = u6sqrt((AlphaMultiplyChannel(f, a) + AlphaMultiplyChannel(b, 63-a)) >> 4);
+    if (BlendChannel(f, b, a) != want) Fail("BlendChannel(%d, %d, %d) = %d.", f, b, a, BlendChannel(f, b, a));
+  }
+}
+
+void Trig() {
+  for (u16 step=0; step<288; step++) {
+    double want = 256 * sin(step * M_PI / 144);
+    if (fabs(Sine(step) - want) > 1) Fail("Sine(%d) = %d, expected %d.", step, Sine(step), lround(want), 0);
+  }
+  for (u16 step=0; step<=256; step++) {
+    s16 dx, dy;  GetVec(step, &dx, &dy);
+    double angle = (272 - step) * M_PI / 144;
+    if (fabs(dx - 256*sin(angle)) > 1  ||  fabs(dy - 256*cos(angle)) > 1)
+      Fail("GetVec(%d) = %d, %d.", step, dx, dy, 0);
+  }
+}
+
+void Circle() {
+  const int cx = 160, cy = 240, t = 8;
+  paint = WHITE;
+  for (int r=t+1; r<=60; r++) {
+    Clear();
+    PlotHollowCircle(cx, cy, r, t);
+    for (int y=-r-t-2; y<=r+t+2; y++) for (int x=-r-t-2; x<=r+t+2; x++) {
+      u16 p = framebuffer[cy+y][cx+x];
+      double d = sqrt(x*x + y*y);
+      if (d <= r-t-1  &&  p)             Fail("Circle r %d: pixel %d,%d inside the ring is set.", r, x, y, 0);
+      if (d >= r+t+1  &&  p)             Fail("Circle r %d: pixel %d,%d outside the ring is set.", r, x, y, 0);
+      if (d >= r-t+1  &&  d <= r+t-1  &&  p != WHITE) Fail("Circle r %d: pixel %d,%d within the ring is %04x.", r, x, y, p);
+      if (p != framebuffer[cy-y][cx+x]  ||  p != framebuffer[cy+y][cx-x]  ||  p != framebuffer[cy+x][cx+y])
+        Fail("Circle r %d: pixel %d,%d is not symmetric.", r, x, y, 0);
+    }
+  }
+}
+
+void Scale() {
+  const int cx = 160, cy = 240;
+  const u16 p = 0x8400;
+  Clear();
+  scale(cx, cy, p);
+  for (u16 step=0; step<=256; step+=4) {  // Ticks every 8 steps
+    s16 dx, dy;  GetVec(step, &dx, &dy);
+    u16 at = framebuffer[cy + (dy*47 + (dy<0 ? -128 : 128))/256][cx + (dx*47 + (dx<0 ? -128 : 128))/256];
+    if (step % 8  &&  at != p)            Fail("Scale step %d: pixel between ticks is %04x.", step, at, 0, 0);
+    if (!(step % 8)  &&  at == p)         Fail("Scale step %d: tick not drawn.", step, 0, 0, 0);
+  }
+}
+
+void Line() {
+  const int x0 = 160, y0 = 240;
+  foreground = WHITE;  background = BLACK;
+  for (u16 step=0; step<=256; step++) {
+    s16 dx, dy;  GetVec(step, &dx, &dy);
+    Clear();
+    PlotPartLine(x0, y0, dx, dy, (dx*5)/256, (dy*5)/256, (dx*35)/256, (dy*35)/256);
+    double len = sqrt(dx*dx + dy*dy);
+    int lit = 0;
+    for (int y=-40; y<=40; y++) for (int x=-40; x<=40; x++) {
+      if (!framebuffer[y0+y][x0+x]) continue;
+      lit++;
+      double across = (x*dy - y*dx) / len, along = (x*dx + y*dy) / len;
+      if (fabs(across) >= 1.5)            Fail("Line step %d: pixel %d,%d is %d/10 pixels off the line.", step, x, y, (int)(across*10));
+      if (along < 4  ||  along > 37)      Fail("Line step %d: pixel %d,%d is outside the part drawn.", step, x, y, 0);
+    }
+    int steps = abs(dx) > abs(dy) ? abs((dx*35)/256) - abs((dx*5)/256) : abs((dy*35)/256) - abs((dy*5)/256);
+    if (lit < steps) Fail("Line step %d: %d pixels drawn over %d steps.", step, lit, steps, 0);
+  }
+}
+
+// Whether pixel p is fg ramped over bg at within a level of alpha
+int Near(u16 p, u16 fg, u16 bg, int alpha) {
+  for (int a=alpha-1; a<=alpha+1; a++) if (a >= 0  &&  a <= FULL  &&  Ramp(fg, bg, a) == p) return 1;
+  return 0;
+}
+
+// The divisions the rasterizers no longer make
+
+int RingAlpha(int r, int t, int x, int y) {
+  int A = 2*(r+t) + 1,  B = r > t ? 2*(r-t)-1 : 0,  q = 4*(x*x + y*y);
+  if (q >= A*A  ||  (B  &&  q <= B*B)) return 0;
+  int alpha = q > A*A - 4*A ? (FULL * (A*A - q)) / (4*A) : FULL;
+  if (B  &&  q < B*B + 4*B  &&  (FULL * (q - B*B)) / (4*B) < alpha) alpha = (FULL * (q - B*B)) / (4*B);
+  return alpha;
+}
+
+int TickReference(struct tick *k, int x, int y) {
+  if (k->flags & TICKNEGX) x = -x;
+  if (k->flags & TICKNEGY) y = -y;
+  if (k->flags & TICKSWAP) {int s = x; x = y; y = s;}
+  if (x < k->first  ||  x > k->last  ||  y < 0) return 0;
+  int e = abs(y*(int)k->major - x*(int)k->minor);
+  return e >= (int)k->major ? 0 : FULL - (FULL * e) / k->major;
+}
+
+void Coverages() {
+  const int cx = 160, cy = 240;
+  paint = WHITE;
+  for (int r=9; r<=60; r++) {
+    Clear();
+    PlotHollowCircle(cx, cy, r, 8);
+    for (int y=-r-9; y<=r+9; y++) for (int x=-r-9; x<=r+9; x++) {
+      int want = RingAlpha(r, 8, x, y);
+      if (!Near(framebuffer[cy+y][cx+x], WHITE, BLACK, want)) Fail("Coverage ring r %d: pixel %d,%d is not alpha %d.", r, x, y, want);
+    }
+  }
+
+  // Every tick pixel, wherever the spans might have clipped it
+  struct tick ticks[256/TICKSTEP + 1];
+  const u16 p = 0x8400;
+  u8 n = 0;
+  for (u16 step=0; step<=256; step+=TICKSTEP) Tick(&ticks[n++], step);
+  Clear();
+  scale(cx, cy, p);
+  for (int y=-54; y<=54; y++) for (int x=-54; x<=54; x++) {
+    int want = 0;
+    for (u8 i=0; i<n; i++) {int a = TickReference(ticks+i, x, y);  if (a > want) want = a;}
+    if (want > 1  &&  !Near(framebuffer[cy+y][cx+x], WHITE, p, want))
+      Fail("Coverage tick: pixel %d,%d is %04x, expected alpha %d.", x, y, framebuffer[cy+y][cx+x], want);
+  }
+
+  // The line's alpha pairs, from its ideal D steps
+  foreground = WHITE;  background = BLACK;
+  for (u16 step=0; step<=256; step++) {
+    s16 dx, dy;  GetVec(step, &dx, &dy);
+    Clear();
+    PlotPartLine(cx, cy, dx, dy, 0, 0, dx/2, dy/2);  // Half the line fits the screen
+    int sx = dx < 0 ? -1 : 1,  sy = dy < 0 ? -1 : 1;
+    int major = abs(dx), minor = abs(dy), swap = major < minor;
+    if (swap) {int s = major; major = minor; minor = s;}
+    for (int i=1, D=minor, j=0; i<=major/2; i++, D+=minor) {
+      if (D >= major) {j++;  D -= major;}
+      int along = swap ? sy*i : sx*i,  across = swap ? sx*j : sy*j;
+      int x = swap ? across : along,  y = swap ? along : across;
+      int want = FULL - (FULL*D)/major;  // Pixel on the line's side of the pair
+      if (!Near(framebuffer[cy+y][cx+x], WHITE, BLACK, want)) Fail("Coverage line step %d: pixel %d,%d is not alpha %d.", step, x, y, want);
+    }
+  }
+}
+
+void Text() {
+  const int x0 = 10, y0 = 100;
+  int w = 0, h = 0, c;
+  FILE *f = fopen("font5x7.pbm", "r");
+  if (!f  ||  fscanf(f, "P1 #%*[^\n] %d %d", &w, &h) != 2) {Fail("Text: cannot read font5x7.pbm.", 0, 0, 0, 0);  return;}
+
+  paint = WHITE;
+  Clear();
+  u32 regions = lcdstats.regions;
+  int drawn = RenderText(x0, y0, font, " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ");  // A region per TEXTMAX
+  if (drawn != w  ||  lcdstats.regions != regions + (37+TEXTMAX-1)/TEXTMAX) Fail("Text: font drawn %d wide in %d regions.", drawn, lcdstats.regions - regions, 0, 0);
+  for (int y=0; y<h; y++) for (int x=0; x<w; x++) {
+    while ((c = fgetc(f)) != '0'  &&  c != '1'  &&  c != EOF);
+    if (framebuffer[y0+y][x0+x] != (c == '1' ? WHITE : BLACK)) Fail("Text: font pixel %d,%d is %04x.", x, y, framebuffer[y0+y][x0+x], 0);
+  }
+  fclose(f);
+
+  Clear();
+  framebuffer[y0][x0] = 1;
+  if (RenderText(x0, y0, font, "a") != 6  ||  framebuffer[y0][x0]) Fail("Text: a character not in the font is not a space.", 0, 0, 0, 0);
+
+  // Icon a from its image, against the hand coded am1 at 6 bit alphas
+  Clear();
+  RenderAlphaMap(x0, y0, am1);
+  RenderText(x0+10, y0, icons, "a");
+  for (int y=0; y<8; y++) for (int x=0; x<8; x++) {
+    int want = -1;
+    for (int a=0; a<=FULL; a++) if (Ramp(WHITE, BLACK, a) == framebuffer[y0+y][x0+x]) {want = a;  break;}
+    int near = 0;
+    for (int a=want-2; a<=want+2; a++) if (a >= 0  &&  a <= FULL  &&  Ramp(WHITE, BLACK, a) == framebuffer[y0+y][x0+10+x]) near = 1;
+    if (!near) Fail("Text: icon pixel %d,%d is %04x, am1 has %04x.", x, y, framebuffer[y0+y][x0+10+x], framebuffer[y0+y][x0+x]);
+  }
+
+  // One 100x3 glyph: 150 solid, partials 15, 1, 2, 3, 4, then 145 clear
+  static const u8 atlas[] = {
+    3, 2, 'x', 1,
+    7, 0, 100,
+    0xE0, 0x95,  0x84, 0xF1, 0x23, 0x40,  0xC0, 0x90,
+  };
+  Clear();
+  for (int y=0; y<3; y++) for (int x=0; x<102; x++) framebuffer[y0+y][x0+x] = 1;
+  if (RenderText(x0, y0, atlas, "x") != 102) Fail("Text: made up glyph not 102 wide.", 0, 0, 0, 0);
+  for (int i=0; i<300; i++) {
+    u16 want = i < 150 ? WHITE : i < 155 ? Ramp(WHITE, BLACK, (u8[]){63, 4, 8, 12, 17}[i-150]) : BLACK;
+    if (framebuffer[y0 + i/100][x0 + i%100] != want) Fail("Text: made up pixel %d is %04x, expected %04x.", i, framebuffer[y0 + i/100][x0 + i%100], want, 0);
+  }
+  for (int y=0; y<3; y++) if (framebuffer[y0+y][x0+100] | framebuffer[y0+y][x0+101]) Fail("Text: gap of row %d not clear.", y, 0, 0, 0);
+}
+
+int main() {
+  Sqrt();
+  Trig();
+  Circle();
+  Scale();
+  Line();
+  Coverages();
+  Text();
+  if (failures) {fprintf(stderr, "kerneltest: %d failures.\n", failures); return 1;}
+  fprintf(stdout, "kerneltest: kernels match reference results.\n");
+  return 0;
+}
@@ -0,0 +1,85 @@
+// knobtest - drive knobs.h's quadrature decoder with phase sequences on the
+// host and check the steps the main loop applies.
+//
+//   detents      one step each way per detent at slow speed
+//   missed       a detent with a transition missed is still counted
+//   bounce       contact bounce within a detent counts once
+//   spin         24 fast detents sweep the full range, 24 slow ones 24 steps
+//   reverse      a change of direction restarts acceleration
+//   ring         detents beyond the ring size are counted as lost
+//   held         detents with the switch held go to heldturn, leaving the
+//                knob that was current before the press
+//   long press   reported once after HOLDMS, leaving the knob as it was
+
+#include "avrhost.h"
+#include "lcdemu.h"
+#include "../ui.h"
+#include "../knobs.h"
+
+int failures;
+
+void Check(const char *name, int got, int want) {
+  if (got == want) return;
+  if (failures++ < 10) fprintf(stderr, "%s: %d, expected %d.\n", name, got, want);
+}
+
+u16 now;  // Timer 0 counts
+u8 held;  // Switch held
+
+void Phases(const char *seq) { // Pin changes to each phase in turn, digits 0..3
+  for (; *seq; seq++) {
+    t0wraps = now >> 8;  TCNT0 = now & 255;
+    PINB = (held ? 0 : 0x80) | (*seq - '0');
+    PinChangeInterrupt();
+  }
+}
+
+void Turn(int detents, int forward, u16 ms) { // Detents ms apart, the main loop keeping up
+  while (detents--) {now += T0MS(ms);  Phases(forward ? "1023" : "2013");  ReadKnobs();}
+}
+
+u16 Knob(u16 from) { // Apply queued detents to knob 0 from step from, returning the step moved to
+  knobs[0].nextstep = from;
+  ReadKnobs();
+  return knobs[0].nextstep;
+}
+
+int main() {
+  currknob = 0;
+
+  Knob(100);  Turn(3, 1, 200);  Check("detents forward", knobs[0].nextstep, 103);
+  Knob(100);  Turn(3, 0, 200);  Check("detents backward", knobs[0].nextstep, 97);
+
+  now += T0MS(200);  Phases("123");       Check("missed forward", Knob(100), 101);
+  now += T0MS(200);  Phases("203");       Check("missed backward", Knob(100), 99);
+  now += T0MS(200);  Phases("13131023");  Check("bounce", Knob(100), 101);
+
+  Knob(0);  Turn(24, 1, 5);    Check("fast spin", knobs[0].nextstep, 255);
+  now += T0MS(200);
+  Knob(0);  Turn(24, 1, 100);  Check("slow spin", knobs[0].nextstep, 24);
+
+  Knob(100);  Turn(4, 1, 5);  Turn(1, 0, 5);  Check("reverse", knobs[0].nextstep, 100 + 4*16 - 1);
+
+  for (int i=0; i<DETENTS+4; i++) {now += T0MS(200);  Phases("1023");}
+  Check("ring lost", detentslost, 4);
+  Check("ring kept", Knob(0), DETENTS);
+
+  now += T0MS(200);  held = 1;  Phases("3");  Check("held press", currknob, 1);
+  Turn(2, 1, 200);  Timer0Interrupt();  Turn(1, 0, 200);
+  Check("held turns", heldturn, 1);
+  Check("held knob", currknob, 0);
+  Check("held knob still", knobs[0].nextstep, DETENTS);
+  held = 0;  Phases("3");  Timer0Interrupt();  Check("held released", knobdown, 0);
+
+  now += T0MS(200);  held = 1;  Phases("3");
+  Check("long press early", LongPress(), 0);
+  now += T0MS(HOLDMS);  t0wraps = now >> 8;  TCNT0 = now & 255;
+  Check("long press", LongPress(), 1);
+  Check("long press once", LongPress(), 0);
+  Check("long press knob", currknob, 0);
+  held = 0;  Phases("3");  Timer0Interrupt();
+
+  if (failures) {fprintf(stderr, "knobtest: %d failures.\n", failures); return 1;}
+  fprintf(stdout, "knobtest: quadrature decoding and acceleration as expected.\n");
+  return 0;
+}
@@ -0,0 +1,162 @@
+// Emulated ILI9481 for host builds of ui.h.
+//
+// Provides the same bus primitives as ../lcd.h. Column address set (0x2A),
+// page address set (0x2B) and memory write (0x2C/0x3C) are decoded into a
+// 320x480 RGB565 framebuffer, and every bus operation is counted so the
+// cost of a drawing primitive can be measured without a panel or a scope.
+//
+// Address mode (0x36) is accepted but ignored: the framebuffer is kept in
+// the order the controller addresses it, x across and y down.
+
+#define LCDW 320
+#define LCDH 480
+
+u16 framebuffer[LCDH][LCDW];
+
+struct lcdstats {
+  u32 commands;  // Bytes written with CD active
+  u32 strobes;   // WR strobes, command and data
+  u32 regions;   // Memory writes started (0x2C), i.e. region setups
+  u32 pixels;    // Pixel data words stored
+} lcdstats;
+
+struct {
+  u8  cmd;           // Command currently receiving parameters/data
+  u8  nparam;        // Parameter bytes received for cmd
+  u8  param[4];
+  u16 sc, ec;        // Column window
+  u16 sp, ep;        // Page window
+  u16 x, y;          // Memory write position
+  u8  hi, phase;     // First byte of a data word pending when phase=1
+} ili;
+
+void LcdCommandByte(u8 cmd) {
+  lcdstats.commands++; lcdstats.strobes++;
+  ili.cmd = cmd; ili.nparam = 0; ili.phase = 0;
+  if (cmd == 0x2C) {lcdstats.regions++; ili.x = ili.sc; ili.y = ili.sp;}
+}
+
+void LcdPixel(u16 rgb) {
+  if (ili.x < LCDW  &&  ili.y < LCDH) framebuffer[ili.y][ili.x] = rgb;
+  lcdstats.pixels++;
+  if (ili.x < ili.ec) {ili.x++; return;}
+  ili.x = ili.sc;
+  if (ili.y < ili.ep) ili.y++; else ili.y = ili.sp;
+}
+
+void LcdDataByte(u8 b) {
+  lcdstats.strobes++;
+  switch (ili.cmd) {
+    case 0x2A:
+    case 0x2B:
+      if (ili.nparam < 4) ili.param[ili.nparam++] = b;
+      if (ili.nparam == 4) {
+        u16 s = ili.param[0]*256 + ili.param[1];
+        u16 e = ili.param[2]*256 + ili.param[3];
+        if (ili.cmd == 0x2A) {ili.sc = s; ili.ec = e;} else {ili.sp = s; ili.ep = e;}
+      }
+      break;
+    case 0x2C:
+    case 0x3C:
+      if (ili.phase == 0) {ili.hi = b; ili.phase = 1;}
+      else                {LcdPixel(ili.hi*256 + b); ili.phase = 0;}
+      break;
+  }
+}
+
+
+// Bus primitives as in ../lcd.h
+
+#define Bytes(...) (u8[]){__VA_ARGS__}, sizeof((u8[]){__VA_ARGS__})
+
+void SendCommand(u8 cmd) {LcdCommandByte(cmd);}
+
+void CommandLcd(const u8 *buf, u8 len) {
+  SendCommand(buf[0]);
+  buf++; len--;
+  while (len--) LcdDataByte(*(buf++));
+}
+
+void SendDataWord(u16 w) {LcdDataByte(w / 256); LcdDataByte(w % 256);}
+
+void BlitFill(u16 rgb, u16 count) {while (count--) SendDataWord(rgb);}
+
+void RepeatDataWord(u16 w, u8 len) {BlitFill(w, len ? len : 256);} // len 0 => 256 times.
+
+void BlitFlash(FlashAddr pixels, u16 count) {
+  while (count--) {SendDataWord(__LPM_word(pixels)); pixels += 2;}
+}
+
+void ReleaseLcd() {}
+
+
+// Image output
+
+void RGB888(u16 rgb, u8 *p) {
+  p[0] = ((rgb >> 8) & 0xF8) | (rgb >> 13);
+  p[1] = ((rgb >> 3) & 0xFC) | ((rgb >> 9) & 3);
+  p[2] = ((rgb << 3) & 0xF8) | ((rgb >> 2) & 7);
+}
+
+int WritePPM(const char *filename) {
+  FILE *f = fopen(filename, "wb");  if (!f) return 0;
+  fprintf(f, "P6\n%d %d\n255\n", LCDW, LCDH);
+  for (int y=0; y<LCDH; y++) for (int x=0; x<LCDW; x++) {
+    u8 p[3]; RGB888(framebuffer[y][x], p); fwrite(p, 1, 3, f);
+  }
+  return fclose(f) == 0;
+}
+
+u32 Crc32(u32 crc, const u8 *p, u32 len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *(p++);
+    for (int i=0; i<8; i++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+void PngChunk(FILE *f, const char *type, const u8 *data, u32 len) {
+  u8 hdr[8] = {len>>24, len>>16, len>>8, len, type[0], type[1], type[2], type[3]};
+  fwrite(hdr, 1, 8, f);  fwrite(data, 1, len, f);
+  u32 crc = Crc32(Crc32(0, hdr+4, 4), data, len);
+  u8 tail[4] = {crc>>24, crc>>16, crc>>8, crc};
+  fwrite(tail, 1, 4, f);
+}
+
+int WritePNG(const char *filename) { // Uncompressed (stored) deflate blocks, one per row
+  FILE *f = fopen(filename, "wb");  if (!f) return 0;
+  const u32 rowlen = 1 + 3*LCDW;             // Filter byte + RGB
+  const u32 blklen = 5 + rowlen;             // Stored block header + row
+  u32 zlen = 2 + blklen*LCDH + 4;
+  u8 *z = malloc(zlen), *p = z;
+  u32 a = 1, b = 0;                          // Adler-32
+
+  *(p++) = 0x78; *(p++) = 0x01;
+  for (int y=0; y<LCDH; y++) {
+    *(p++) = (y == LCDH-1);                  // BFINAL on the last row, BTYPE stored
+    *(p++) = rowlen & 255;  *(p++) = rowlen >> 8;
+    *(p++) = ~rowlen & 255; *(p++) = (~rowlen >> 8) & 255;
+    u8 *row = p;
+    *(p++) = 0;                              // Filter: none
+    for (int x=0; x<LCDW; x++) {RGB888(framebuffer[y][x], p); p += 3;}
+    for (u32 i=0; i<rowlen; i++) {a = (a + row[i]) % 65521; b = (b + a) % 65521;}
+  }
+  u32 adler = (b << 16) | a;
+  *(p++) = adler>>24; *(p++) = adler>>16; *(p++) = adler>>8; *(p++) = adler;
+
+  static const u8 sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  u8 ihdr[13] = {0,0,LCDW>>8,LCDW&255, 0,0,LCDH>>8,LCDH&255, 8, 2, 0, 0, 0};
+  fwrite(sig, 1, 8, f);
+  PngChunk(f, "IHDR", ihdr, 13);
+  PngChunk(f, "IDAT", z, zlen);
+  PngChunk(f, "IEND", 0, 0);
+  free(z);
+  return fclose(f) == 0;
+}
+
+int WriteImage(const char *filename) { // .ppm or .png by extension
+  const char *ext = strrchr(filename, '.');
+  if (ext && strcmp(ext, ".ppm") == 0) return WritePPM(filename);
+  return WritePNG(filename);
+}
@@ -0,0 +1,126 @@
+// pointergen - generate pointers.h, the flash table of knob pointer sprites.
+//
+// Each of the 257 pointer positions is rendered with ui.h's own PlotPointer
+// into the emulated framebuffer and read back as (x, y, alpha) pixels
+// relative to the knob centre. Positions that are mirror images or
+// transposes of one another share a single canonical sprite, stored as
+// runs along the rows of an x-major line:
+//
+//   pointerspritedata: per sprite: first row v, row count,
+//                      then per row: first u, pixel count, alphas...
+//
+// Pointers are always drawn WHITE over BLACK, so each pixel's alpha is
+// read back as the lowest alpha that BlendPixel turns into the colour found
+// in the framebuffer. Equal alphas in the table therefore mean equal
+// colours on screen. The framebuffer is first filled with BLUE, which a
+// WHITE over BLACK blend cannot produce, to tell untouched pixels apart.
+
+#include "avrhost.h"
+#include "lcdemu.h"
+#define PLOTLINE 1  // ui.h's line plotter, for the pointers
+#include "../ui.h"
+
+#define CX 160
+#define CY 240
+#define MAXPIXELS 128
+#define MAXROWS   40    // Must match POINTERROWS in ../knobs.h
+
+struct pixel {s16 u, v; u8 alpha;};
+
+struct sprite {
+  int npixels;
+  struct pixel pixel[MAXPIXELS];  // Canonical coordinates, sorted by v then u
+} sprites[257];
+int nsprites;
+
+u8 spriteof[257];
+
+int ComparePixels(const void *a, const void *b) {
+  const struct pixel *p = a, *q = b;
+  return p->v != q->v ? p->v - q->v : p->u - q->u;
+}
+
+int main() {
+  // Build the colour to lowest alpha map for WHITE over BLACK
+  static s8 alphaof[65536];
+  memset(alphaof, -1, sizeof(alphaof));
+  for (int a=FULL; a>=0; a--) alphaof[BlendPixel(WHITE, BLACK, a)] = a;
+  if (alphaof[BLUE] >= 0) {fprintf(stderr, "pointergen: BLUE is a WHITE over BLACK blend.\n"); return 1;}
+
+  for (int step=0; step<=256; step++) {
+    for (int y=0; y<LCDH; y++) for (int x=0; x<LCDW; x++) framebuffer[y][x] = BLUE;
+    foreground = WHITE; background = BLACK;
+    PlotPointer(CX, CY, step);
+
+    s16 dx, dy;  GetVec(step, &dx, &dy);
+    int sx = dx < 0,  sy = dy < 0,  swap = abs(dx) < abs(dy);  // As derived in ../knobs.h
+
+    struct sprite s = {0};
+    for (int y=0; y<LCDH; y++) for (int x=0; x<LCDW; x++) {
+      if (framebuffer[y][x] == BLUE) continue;
+      if (alphaof[framebuffer[y][x]] < 0) {fprintf(stderr, "pointergen: step %d: unexpected colour %04x.\n", step, framebuffer[y][x]); return 1;}
+      int a = sx ? CX-x : x-CX;
+      int b = sy ? CY-y : y-CY;
+      if (s.npixels >= MAXPIXELS) {fprintf(stderr, "pointergen: step %d: too many pixels.\n", step); return 1;}
+      s.pixel[s.npixels].u     = swap ? b : a;
+      s.pixel[s.npixels].v     = swap ? a : b;
+      s.pixel[s.npixels].alpha = alphaof[framebuffer[y][x]];
+      s.npixels++;
+    }
+    qsort(s.pixel, s.npixels, sizeof(struct pixel), ComparePixels);
+
+    // Each canonical row must be a single run of pixels
+    for (int i=1; i<s.npixels; i++) {
+      if (s.pixel[i].v == s.pixel[i-1].v  &&  s.pixel[i].u != s.pixel[i-1].u+1) {
+        fprintf(stderr, "pointergen: step %d: row %d is not contiguous.\n", step, s.pixel[i].v); return 1;
+      }
+    }
+    if (s.npixels == 0  ||  s.pixel[s.npixels-1].v - s.pixel[0].v + 1 > MAXROWS) {
+      fprintf(stderr, "pointergen: step %d: bad row count.\n", step); return 1;
+    }
+
+    int i;
+    for (i=0; i<nsprites; i++) {
+      if (sprites[i].npixels == s.npixels  &&  !memcmp(sprites[i].pixel, s.pixel, s.npixels*sizeof(struct pixel))) break;
+    }
+    if (i == nsprites) sprites[nsprites++] = s;
+    spriteof[step] = i;
+  }
+
+  fprintf(stdout, "// Generated by host/pointergen from ui.h's PlotPointer - do not edit.\n\n");
+  fprintf(stdout, "#define POINTERSPRITES %d\n\n", nsprites);
+
+  fprintf(stdout, "const u8 PROGMEM pointersprite[257] = {  // Canonical sprite for each step\n");
+  for (int step=0; step<=256; step++) fprintf(stdout, "%s%2d,%s", step%16 ? " " : "  ", spriteof[step], step%16 == 15 || step == 256 ? "\n" : "");
+  fprintf(stdout, "};\n\n");
+
+  int offset = 0;
+  fprintf(stdout, "const u16 PROGMEM pointerspriteoffset[POINTERSPRITES] = {\n");
+  for (int i=0; i<nsprites; i++) {
+    struct sprite *s = &sprites[i];
+    fprintf(stdout, "  %4d,\n", offset);
+    int start = offset;
+    offset += 2 + 2*(s->pixel[s->npixels-1].v - s->pixel[0].v + 1) + s->npixels;
+    if (offset - start > 255) {fprintf(stderr, "pointergen: sprite %d too long.\n", i); return 1;}
+  }
+  fprintf(stdout, "};\n\n");
+
+  fprintf(stdout, "const u8 PROGMEM pointerspritedata[%d] = {\n", offset);
+  for (int i=0; i<nsprites; i++) {
+    struct sprite *s = &sprites[i];
+    int first = s->pixel[0].v,  rows = s->pixel[s->npixels-1].v - first + 1;
+    fprintf(stdout, "  // Sprite %d\n  %d, %d,\n", i, (u8)first, rows);
+    int j = 0;
+    for (int v=first; v<first+rows; v++) {
+      int n = 0;  while (j+n < s->npixels  &&  s->pixel[j+n].v == v) n++;
+      fprintf(stdout, "  %d, %d, ", n ? (u8)s->pixel[j].u : 0, n);
+      for (int k=0; k<n; k++) fprintf(stdout, " %2d,", s->pixel[j+k].alpha);
+      fprintf(stdout, "\n");
+      j += n;
+    }
+  }
+  fprintf(stdout, "};\n");
+
+  fprintf(stderr, "pointergen: %d canonical sprites, %d bytes of sprite data.\n", nsprites, offset);
+  return 0;
+}
@@ -0,0 +1,57 @@
+// rfbench - run wireless.h's interrupt driven transmission on the host and
+// report the SPI traffic per packet.
+//
+// The SPI transfer complete interrupt is played by calling SpiInterrupt
+// directly, and the main loop's polling by calling RfPoll, which finds every
+// packet sent, or reaching MAX_RT. Every byte read is STATUS, with no flags
+// set while a packet is being loaded, and FIFO_STATUS reads as TX_EMPTY. Packets are queued a burst at a time, a
+// burst of broadcasts being pipelined into the TX FIFO.
+
+#include "avrhost.h"
+
+void delay(int ms) {(void)ms;}
+
+#include "../wireless.h"
+
+u32 interrupts;
+u8  status = 0x2E;  // TX_DS
+
+void Transmit() { // Run the queue dry
+  while (!RfIdle()) {
+    while (rfstate != RFSENDING  &&  rfstate != RFIDLE) {
+      SPDR = rfstate == RFLOADING ? 0x0E : status;
+      SpiInterrupt();
+      interrupts++;
+    }
+    if (rfstate == RFSENDING) RfPoll();
+  }
+}
+
+void Report(const char *name, u8 address, u32 count, u8 burst) {
+  u8 payload[PAYLOAD] = {MSGCOLOURS, 0x0F};
+  u16 clocked = rfclocked, saved = rfsaved;
+  u32 ints = interrupts;
+  for (u32 i=0; i<count; i++) {
+    payload[2] = i;
+    RfWrite(address ? address : '1' + i%4, payload);
+    if ((i+1) % burst == 0) Transmit();
+  }
+  fprintf(stdout, "%-34s %10.1f %10.1f %10.1f\n", name,
+    (double)(u16)(rfclocked - clocked) / count,
+    (double)(u16)(rfsaved - saved) / count,
+    (double)(interrupts - ints) / count);
+}
+
+int main() {
+  PINB = 0xFF;
+  InitWireless();
+  fprintf(stdout, "%-34s %10s %10s %10s\n", "per packet", "clocked", "saved", "interrupts");
+  Report("Broadcast colours",        BROADCAST, 100, 1);
+  Report("Broadcast frames, 3 at once", BROADCAST, 99, 3);
+  Report("Each strip in turn",       0,         100, 1);
+  Report("One strip",                STRIP(0),  100, 1);
+  status = 0x1E;  // MAX_RT
+  Report("One strip, reaching MAX_RT", STRIP(0), 100, 1);
+  fprintf(stdout, "%-34s %10u %10u\n", "Strip 0 packets acked, failed", links[0].acked, links[0].failed);
+  return 0;
+}
@@ -0,0 +1,103 @@
+// scenetest - drive scenes.h against an emulated eeprom on the host and
+// check what is stored and how often each byte is written.
+//
+//   erased       an erased eeprom has no last scene and no scenes stored
+//   store        a scene reads back, and is the last scene after power up
+//   unchanged    storing the same colours again writes nothing
+//   coalesce     a burst of stores of one scene writes each changed byte once
+//   replace      storing a scene part written leaves the later colours
+//   interleave   storing another scene first finishes the one being written
+//   busy         nothing is written while the eeprom is busy
+//   ring         every count of scene changes powers up in the last scene,
+//                with ring bytes written once per RINGSIZE changes
+
+#include "avrhost.h"
+
+// Emulated eeprom: each write leaves it busy for one EepromBusy poll
+
+u8  eeprom[1024];
+u32 writes[1024];
+u8  busy;
+
+u8   EepromBusy()                        {u8 b = busy;  busy = 0;  return b;}
+u8   EepromRead(u16 address)             {busy = 0;  return eeprom[address];}
+void EepromWrite(u16 address, u8 value);
+
+#include "../scenes.h"
+
+int failures;
+
+void Check(const char *name, int got, int want) {
+  if (got == want) return;
+  if (failures++ < 10) fprintf(stderr, "%s: %d, expected %d.\n", name, got, want);
+}
+
+void EepromWrite(u16 address, u8 value) {
+  if (busy) Check("write while busy", address, -1);
+  eeprom[address] = value;  writes[address]++;  busy = 1;
+}
+
+void Drain() {while (store.scene != NOSCENE  ||  ringentry != NOSCENE) EepromStep();}
+
+u32 Writes() {u32 n = 0;  for (int i=0; i<1024; i++) n += writes[i];  return n;}
+
+void PowerUp() { // Forget everything but the eeprom
+  store.scene = ringentry = lastscene = NOSCENE;
+  FindRing();
+}
+
+void Colours(u8 *c, u8 seed) {for (u8 i=0; i<SCENESIZE-1; i++) c[i] = seed + i*7;}
+
+int main() {
+  u8 c[SCENESIZE-1], got[SCENESIZE-1];
+
+  memset(eeprom, 0xFF, sizeof eeprom);
+  PowerUp();
+  Check("erased last scene", lastscene, NOSCENE);
+  for (u8 s=0; s<SCENES; s++) Check("erased scene", LoadScene(s, got), 0);
+
+  Colours(c, 10);  SaveScene(5, c);  Drain();
+  PowerUp();
+  Check("store last scene", lastscene, 5);
+  Check("store loads", LoadScene(5, got), 1);
+  Check("store reads back", memcmp(got, c, sizeof c), 0);
+
+  u32 before = Writes();
+  SaveScene(5, c);  Drain();
+  Check("unchanged writes", Writes() - before, 1);  // The ring entry alone
+
+  before = Writes();
+  for (u8 n=0; n<20; n++) {Colours(c, 100+n);  SaveScene(5, c);}
+  c[0] = 10;  SaveScene(5, c);  Drain();  // Byte 0 as it was
+  Check("coalesce writes", Writes() - before, 15 + 1);  // Bytes 1..15 and one ring entry
+  LoadScene(5, got);
+  Check("coalesce reads back", memcmp(got, c, sizeof c), 0);
+
+  Colours(c, 30);  SaveScene(5, c);  EepromStep();
+  Colours(c, 40);  SaveScene(5, c);  Drain();
+  Check("replace reads back", LoadScene(5, got)  &&  !memcmp(got, c, sizeof c), 1);
+
+  u8 d[SCENESIZE-1];
+  Colours(d, 200);
+  SaveScene(6, d);  EepromStep();  SaveScene(7, c);  Drain();
+  Check("interleave first", LoadScene(6, got)  &&  !memcmp(got, d, sizeof d), 1);
+  Check("interleave second", LoadScene(7, got)  &&  !memcmp(got, c, sizeof c), 1);
+
+  Colours(c, 50);  SaveScene(8, c);
+  busy = 1;  Check("busy step", EepromStep(), 0);
+  Drain();
+
+  memset(eeprom, 0xFF, sizeof eeprom);  memset(writes, 0, sizeof writes);
+  PowerUp();
+  const int changes = 1000;
+  for (int n=0; n<changes; n++) {
+    LogScene(n*7 % SCENES);  Drain();
+    PowerUp();
+    if (lastscene != n*7 % SCENES) {Check("ring last scene", lastscene, n*7 % SCENES);  break;}
+  }
+  for (int i=0; i<RINGSIZE; i++) if (writes[EERING+i] > changes/RINGSIZE + 1) Check("ring byte writes", writes[EERING+i], changes/RINGSIZE + 1);
+
+  if (failures) {fprintf(stderr, "scenetest: %d failures.\n", failures); return 1;}
+  fprintf(stdout, "scenetest: scenes stored, coalesced and restored as expected.\n");
+  return 0;
+}
@@ -0,0 +1,52 @@
+// uibench - run ui.h against the emulated ILI9481 and report bus operations.
+//
+// Usage: uibench [image.png|image.ppm]
+//
+// Prints the commands, WR strobes, region setups and pixels written by
+// Initscreen, by each drawing primitive it uses, and by UpdatePointer, then
+// optionally dumps the screen as left by Initscreen.
+
+#include "avrhost.h"
+#include "lcdemu.h"
+#define PLOTLINE 1  // ui.h's line plotter, for the pointers
+#include "../ui.h"
+#include "../knobs.h"
+
+struct lcdstats before;
+
+void Begin() {before = lcdstats;}
+
+void Report(const char *name, u32 count) { // count: number of calls averaged over
+  fprintf(stdout, "%-34s %10.1f %10.1f %10.1f %10.1f\n", name,
+    (double)(lcdstats.commands - before.commands) / count,
+    (double)(lcdstats.strobes  - before.strobes)  / count,
+    (double)(lcdstats.regions  - before.regions)  / count,
+    (double)(lcdstats.pixels   - before.pixels)   / count);
+}
+
+#define Measure(name, ...) do {Begin(); __VA_ARGS__; Report(name, 1);} while (0)
+
+int main(int argc, char **argv) {
+  fprintf(stdout, "%-34s %10s %10s %10s %10s\n", "", "commands", "strobes", "regions", "pixels");
+
+  Measure("Initscreen", Initscreen());
+  if (argc > 1  &&  !WriteImage(argv[1])) {fprintf(stderr, "Cannot write %s.\n", argv[1]); return 1;}
+
+  Measure("  FillColour 320x480",       FillColour(0,0, 320,480, 0));
+  Measure("  RenderAlphaMap am1",       RenderAlphaMap(10,10, am1));
+  Measure("  RenderText icon a",        RenderText(10,10, icons, "a"));
+  Measure("  DrawLabel",                DrawLabel(&knobs[0]));
+  Measure("  RenderText 30 characters", RenderText(4,24, font, "PROBE  COUNT   MIN   AVG   MAX"));
+  Measure("  PlotHollowCircle r46 t8",  paint = 0xFA20; PlotHollowCircle(260, 60, 46, 8));
+  Measure("  scale",                    scale(260, 60, 0xFA20));
+  Measure("  DrawPointer",              DrawPointer(260, 60, 128, WHITE));
+
+  // Turn knob 0 from one end of its scale to the other a step at a time
+  struct knob *k = &knobs[0];
+  k->nextstep = 0; UpdatePointer(k);
+  Begin();
+  for (u16 step=1; step<=255; step++) {k->nextstep = step; UpdatePointer(k);}
+  Report("UpdatePointer (avg over 255 steps)", 255);
+
+  return 0;
+}
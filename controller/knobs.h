@@ -0,0 +1,369 @@
+struct knob {
+  u16 x, y;
+  u16 curstep, nextstep;
+  u16 colourstep;        // Step last applied to the strip colours
+  u8 reading;
+  u16 detentat;          // Timer 0 time of the last detent applied
+  s8  detentdir;         // Its direction, +1 or -1
+  u16 labelstep;         // Step shown by the label
+} knobs[4];
+
+struct knob *rknob  = &knobs[0];
+struct knob *gknob  = &knobs[1];
+struct knob *bknob  = &knobs[2];
+struct knob *wwknob = &knobs[3];
+
+u8 currknob = 3;
+u8 knobdown = 0;
+
+// Pointer sprites
+//
+// pointers.h, generated by host/pointergen, holds every pointer position as
+// it is drawn by PlotPointer, reduced by symmetry to a few canonical x-major
+// sprites stored as one run of alphas per row. A position's sprite is the
+// canonical one mirrored and/or transposed according to the signs and
+// relative size of its GetVec vector.
+//
+// A pointer is redrawn by comparing the old and new sprites line by line
+// (rows, or columns for steep pointers) and writing only the span of each
+// line whose pixels actually change.
+
+#include "pointers.h"
+
+#define POINTERROWS 40
+
+struct sprite {
+  u8  swap;                    // Canonical rows are screen columns
+  u8  flipline;                // Screen line is minus canonical row
+  u8  flipalong;               // Screen position along line is minus canonical u
+  s8  first;                   // Canonical row of first run
+  u8  rows;
+  u16 base;                    // Offset of sprite in pointerspritedata
+  u8  rowoffset[POINTERROWS];  // Offset of each row's run from base
+} oldsprite, newsprite;
+
+struct run {
+  s16 start, end;              // Extent along line relative to knob centre
+  FlashAddr alpha;             // Alpha of pixel at start
+  s8  dir;                     // Direction of successive alphas in flash
+};
+
+void LoadSprite(struct sprite *s, u16 step) {
+  s16 dx, dy;
+  GetVec(step, &dx, &dy);
+  s->swap      = (dx < 0 ? -dx : dx) < (dy < 0 ? -dy : dy);
+  s->flipline  = s->swap ? dx < 0 : dy < 0;
+  s->flipalong = s->swap ? dy < 0 : dx < 0;
+
+  u8 i = __LPM((FlashAddr)(pointersprite+step));
+  s->base = __LPM_word((FlashAddr)(pointerspriteoffset+i));
+  FlashAddr p = (FlashAddr)(pointerspritedata + s->base);
+  s->first = __LPM(p);
+  s->rows  = __LPM(p+1);
+
+  u8 offset = 2;
+  for (i=0; i<s->rows; i++) {
+    s->rowoffset[i] = offset;
+    offset += 2 + __LPM(p+offset+1);
+  }
+}
+
+void SpriteRun(struct sprite *s, s8 line, struct run *r) { // s 0 => no sprite
+  r->start = 1;  r->end = 0;
+  if (!s) return;
+  s8 v = s->flipline ? -line : line;
+  if (v < s->first  ||  v >= s->first + s->rows) return;
+
+  FlashAddr p = (FlashAddr)(pointerspritedata + s->base + s->rowoffset[v - s->first]);
+  s8 u = __LPM(p);
+  u8 n = __LPM(p+1);
+  if (!n) return;
+  if (s->flipalong) {r->start = -(u+n-1); r->end = -u;    r->alpha = p+2+n-1; r->dir = -1;}
+  else              {r->start = u;        r->end = u+n-1; r->alpha = p+2;     r->dir = 1;}
+}
+
+u8 RunAlpha(struct run *r, s16 i) {
+  if (i < r->start  ||  i > r->end) return 0;
+  return __LPM(r->alpha + r->dir*(i - r->start));
+}
+
+void SpriteLines(struct sprite *s, s8 *lo, s8 *hi) { // Extend lo..hi to cover s's lines
+  if (!s) return;
+  s8 first = s->flipline ? -(s->first + s->rows - 1) : s->first;
+  if (first < *lo) *lo = first;
+  if (first + s->rows - 1 > *hi) *hi = first + s->rows - 1;
+}
+
+// Pointer redraws are done a line at a time so that the main loop can run
+// more urgent work between lines: StartPointer sets up the redraw of a
+// knob's pointer from curstep to nextstep, and each call of PointerSlice
+// then writes at most one changed span, returning 0 once the redraw is
+// complete.
+
+struct knob   *drawknob;         // Knob whose pointer is being redrawn, 0 if none
+struct sprite *drawold;          // Sprite being replaced, 0 for none
+struct sprite *drawnew;          // Sprite being drawn, 0 for none
+s8             drawline;         // Next line to compare
+s8             drawlast;         // Last line to compare
+u8             drawafter;        // Draw newsprite from nothing once this pass completes
+u16            drawstart;        // Probe time at which the redraw started
+
+void BeginPass(struct sprite *old, struct sprite *new) { // old and new have the same orientation
+  drawold  = old;  drawnew  = new;
+  drawline = 127;  drawlast = -128;
+  SpriteLines(old, &drawline, &drawlast);
+  SpriteLines(new, &drawline, &drawlast);
+}
+
+u8 DiffLine(struct knob *k, s8 line) { // Returns whether a span was written
+  struct run o, n;
+  SpriteRun(drawold, line, &o);
+  SpriteRun(drawnew, line, &n);
+  s16 first = 127, last = -128;
+  if (o.start <= o.end) {first = o.start; last = o.end;}
+  if (n.start <= n.end) {if (n.start < first) first = n.start;  if (n.end > last) last = n.end;}
+
+  while (first <= last  &&  RunAlpha(&o, first) == RunAlpha(&n, first)) first++;
+  while (last >= first  &&  RunAlpha(&o, last)  == RunAlpha(&n, last))  last--;
+  if (first > last) return 0;
+
+  if ((drawold ? drawold : drawnew)->swap) WriteRegion(k->x+line, k->y+first, k->x+line, k->y+last);
+  else                                      WriteRegion(k->x+first, k->y+line, k->x+last, k->y+line);
+  for (; first<=last; first++) SendDataWord(Ramp(WHITE, BLACK, RunAlpha(&n, first)));
+  ReleaseLcd();
+  return 1;
+}
+
+void StartPointer(struct knob *k) {
+  drawstart = ProbeStart();
+  ProbeAdd(PROBESTEPS, k->nextstep > k->curstep ? k->nextstep - k->curstep : k->curstep - k->nextstep);
+  LoadSprite(&oldsprite, k->curstep);
+  LoadSprite(&newsprite, k->nextstep);
+  k->curstep = k->nextstep;
+  drawknob = k;
+  drawafter = oldsprite.swap != newsprite.swap;
+  if (drawafter) BeginPass(&oldsprite, 0); else BeginPass(&oldsprite, &newsprite);
+}
+
+u8 PointerSlice() {
+  while (drawknob) {
+    if (drawline > drawlast) {
+      if (drawafter) {drawafter = 0;  BeginPass(0, &newsprite);  continue;}
+      drawknob = 0;
+      ProbeEnd(PROBEPOINTER, drawstart);
+      break;
+    }
+    if (DiffLine(drawknob, drawline++)) return 1;
+  }
+  return 0;
+}
+
+void UpdatePointer(struct knob *k) {
+  StartPointer(k);
+  while (PointerSlice());
+}
+
+// Each knob's step is shown as a number to the left of its scale, in
+// font.h's atlas (see RenderText), redrawn by LabelTask in controller.c
+// once the pointers are idle.
+
+#include "font.h"
+#include "icons.h"
+
+#define LABELX 74        // Label's left edge, left of the knob's centre
+
+void DrawLabel(struct knob *k) {
+  char s[4] = "  0";
+  u16 n = k->curstep;
+  for (u8 i=3; n; n/=10) s[--i] = '0' + n%10;
+  paint = WHITE;
+  RenderText(k->x - LABELX, k->y - FONTH/2, font, s);
+  k->labelstep = k->curstep;
+}
+
+void InitKnob(u16 x, u16 y, u16 colour, struct knob *k) {
+  k->x        = x;
+  k->y        = y;
+  k->curstep  = 128;
+  k->nextstep = 128;
+  k->reading  = 0;
+  scale(x, y, colour);
+  LoadSprite(&newsprite, k->curstep);
+  drawknob = k;  drawafter = 0;  BeginPass(0, &newsprite);
+  while (PointerSlice());
+  DrawLabel(k);
+}
+
+void TurnKnob(struct knob *k, s16 steps) {
+  s16 step = k->nextstep + steps;
+  k->nextstep = step < 0 ? 0 : step > 255 ? 255 : step;
+}
+
+
+//----------------------------------------------------------------------------//
+
+// Initscreen is drawn in INITSCREENSTEPS steps, so that other
+// initialisation can run between them (see BootTask in controller.c).
+
+#define INITSCREENSTEPS 7
+
+void InitscreenStep(u8 step) {
+  switch (step) {
+    case 0:
+      printf("Clear to black.\n");
+      FillColour(0,0, 320,480, 0);       // Clear screen to black
+      break;
+
+    case 1:
+      printf("RenderText icon a.\n");
+      paint = YELLOW;
+      RenderText(10,10, icons, "a");
+      break;
+
+    case 2: printf("Plot the colour knob scales.\n");
+            InitKnob(260, 60, 0xFA20, rknob);   break;
+    case 3: InitKnob(260,180, 0x8400, gknob);   break;
+    case 4: InitKnob(260,300, 0x49F1, bknob);   break;
+    case 5: InitKnob(260,420, 0xCDCA, wwknob);  break;
+
+    case 6:
+      for (int i=0; i<4; i++) {
+        knobs[i].nextstep=0; UpdatePointer(&knobs[i]); knobs[i].colourstep=0; DrawLabel(&knobs[i]);
+      }
+      break;
+  }
+}
+
+void Initscreen() {for (u8 step=0; step<INITSCREENSTEPS; step++) InitscreenStep(step);}
+
+// Knob input
+//
+// Timer 0 runs freely at 128us a count, and with its overflows counted in
+// t0wraps gives the time of each detent, wrapping after 8.4s. A press of the
+// knob's switch also sets compare match A to interrupt 255 counts (32ms)
+// later, debouncing the release; while the switch is still held it
+// interrupts again every 256 counts.
+
+u8 t0wraps;
+
+u16 Timer0Time() { // With interrupts disabled
+  u8 lo = TCNT0, hi = t0wraps;
+  if ((TIFR0 & 1)  &&  lo < 128) hi++;  // Overflowed since the interrupt was blocked
+  return hi << 8 | lo;
+}
+
+void Timer0Overflow() {t0wraps++;}
+
+// The encoder's phases, on PB1 and PB0, rest at 3 at each detent. Each
+// pin change looks up the previous and current phases in quadrature[]:
+// +1 for a quarter step forward, -1 backward, 0 for no change or for both
+// phases changing at once, where a transition was missed. Quarters are summed
+// until the phases return to the detent, whose direction is then the sign of
+// the sum, so a detent is still counted when a transition is missed.
+
+const s8 PROGMEM quadrature[16] = { // [previous phase << 2 | phase]
+//   to 0   1   2   3
+       0, -1, +1,  0,  // from 0
+      +1,  0,  0, -1,  // from 1
+      -1,  0,  0, +1,  // from 2
+       0, +1, -1,  0   // from 3
+};
+
+u8 phase = 3;            // Phases at the previous pin change
+s8 quarters;             // Quarter steps since the last detent
+
+// Detents are passed to the main loop in a ring written only by the
+// interrupt (detenthead) and read only by ReadKnobs (detenttail), so neither
+// side needs to block the other.
+//
+// A detent turned with the switch held is queued for HELDKNOB instead of a
+// colour, and undoes the advance to the next colour that the press made.
+// ReadKnobs sums such detents in heldturn, without acceleration, for the
+// includer to take. A press held HOLDMS without turning is reported once by
+// LongPress, which also undoes the advance.
+
+#define DETENTS 16       // Ring size, a power of 2
+#define HELDKNOB 4       // Detent knob for a turn with the switch held
+#define HOLDMS   1000    // Press reported by LongPress
+
+struct detent {
+  u16 time;              // Timer0Time at the detent
+  u8  knob;
+  s8  dir;               // +1 forward, -1 backward
+};
+
+volatile struct detent detents[DETENTS];
+volatile u8 detenthead;  // Next entry to fill
+volatile u8 detenttail;  // Next entry to read
+u16 detentslost;         // Detents dropped with the ring full
+u8 knobturned;           // A detent was turned, or LongPress reported, during this press
+u16 pressedat;           // Timer0Time of the press
+s8 heldturn;             // Detents turned with the switch held, not yet taken
+
+void PinChangeInterrupt() {
+  u8 port = PINB;
+
+  u8 pressed = (port & 0x80) == 0;
+  if (pressed) { // Knob is pressed
+    if (knobdown == 0) {currknob = (currknob+1) % 4;  knobturned = 0;  pressedat = Timer0Time();} // Advance colour at first suggestion of press
+    knobdown = 1;
+    OCR0A    = TCNT0 - 1;  // Interrupt 255 counts from now
+    TIFR0    = 2;          // Clear any pending compare match
+    TIMSK0   = 3;          // Enable interrupt on compare match A, as well as overflow
+  }
+
+  u8 now = port & 3;
+  quarters += (s8)__LPM((FlashAddr)(quadrature + (phase << 2 | now)));
+  phase = now;
+  if (now == 3  &&  quarters) {
+    if (pressed  &&  !knobturned) {currknob = (currknob+3) % 4;  knobturned = 1;}
+    if ((u8)(detenthead - detenttail) < DETENTS) {
+      volatile struct detent *d = &detents[detenthead % DETENTS];
+      d->time = Timer0Time();  d->knob = pressed ? HELDKNOB : currknob;  d->dir = quarters > 0 ? 1 : -1;
+      detenthead++;
+    } else detentslost++;
+    quarters = 0;
+  }
+}
+
+void Timer0Interrupt() { // knob has been released for 32ms
+  if ((PINB & 0x80) == 0) return;  // Still held, look again 256 counts on
+  knobdown = 0;
+  TIMSK0 = 1;  // Leave only the overflow interrupt enabled
+}
+
+// Turning faster moves further each detent: detents in the same direction
+// less than 64ms apart move 2 steps, halving the interval each doubles the
+// steps, up to 16 steps below 8ms. A brisk turn of a 24 detent knob covers
+// the full 0..255 range.
+
+#define T0MS(ms) ((ms) * 1000L / 128)  // Timer 0 counts
+
+u8 Acceleration(u16 interval) { // Steps for a detent interval Timer 0 counts after the last
+  u8  steps = 16;
+  u16 limit = T0MS(8);
+  while (steps > 1  &&  interval >= limit) {steps >>= 1;  limit <<= 1;}
+  return steps;
+}
+
+u8 LongPress() { // Returns 1 once a press has been held HOLDMS without turning
+  u8 sreg = SREG;  cli();
+  u8 held = knobdown  &&  !knobturned  &&  (PINB & 0x80) == 0
+         &&  (u16)(Timer0Time() - pressedat) >= T0MS(HOLDMS);
+  if (held) {currknob = (currknob+3) % 4;  knobturned = 1;}
+  SREG = sreg;
+  return held;
+}
+
+void ReadKnobs() { // Apply queued detents
+  while (detenttail != detenthead) {
+    volatile struct detent *d = &detents[detenttail % DETENTS];
+    if (d->knob == HELDKNOB) {heldturn += d->dir;  detenttail++;  continue;}
+    struct knob *k = &knobs[d->knob];
+    u8 steps = d->dir == k->detentdir ? Acceleration(d->time - k->detentat) : 1;
+    k->detentat  = d->time;
+    k->detentdir = d->dir;
+    TurnKnob(k, d->dir * steps);
+    detenttail++;
+  }
+}
@@ -0,0 +1,64 @@
+// ILI9481 8080 bus primitives for the ATmega328.
+//
+// ui.h draws only through SendCommand, CommandLcd, SendDataWord,
+// RepeatDataWord, BlitFill, BlitFlash and ReleaseLcd, so a host build can
+// substitute an emulated panel (see host/lcdemu.h) for this file.
+
+
+// LCD control signals (active low)
+
+#define Rs  0b11011111  // Reset
+#define Cs  0b11101111  // Chip select
+#define Cd  0b11110111  // Command mode
+#define Wr  0b11111011  // Write strobe
+#define Rd  0b11111101  // Read strobe
+
+#define LcdIdle 0b00111110  // Reset, Cs, Cd Ww and Rd inactive
+
+#define CsCdWr    (LcdIdle & Cs & Cd & Wr)  // CS, CD and WR active
+#define CsCdNwr   (LcdIdle & Cs & Cd     )  // CS and CD active, WR inactive
+#define CsNcdNwr  (LcdIdle & Cs          )  // CS active, CD and WR inactive
+#define CsNcdWr   (LcdIdle & Cs      & Wr)  // CS active, CD inactive, WR active
+
+//#define Bytes(...) (u8[]){__VA_ARGS__}
+//template <int len> void CommandLcd(u8 const(&buf)[len]) {
+
+#define Bytes(...) (u8[]){__VA_ARGS__}, sizeof((u8[]){__VA_ARGS__})
+
+void SendCommand(u8 cmd) {
+  PORTC = CsCdWr;  // CS, CD and WR active
+  PORTD = cmd;
+  PORTC = CsCdNwr;  // CS, CD active, WR inactive
+  PORTC = CsNcdNwr;  // CS remains active, CD goes high to return to data mode
+}
+
+void CommandLcd(const u8 *buf, u8 len) {
+  SendCommand(buf[0]);
+  buf++; len--;
+  while (len--) {
+    PORTC = CsNcdWr;   // CS and WR active, CD inactive
+    PORTD = *(buf++);
+    PORTC = CsNcdNwr;  // CS active, WR and CD inactive
+  }
+  PORTC = LcdIdle;  // CS and CD both go inactive
+}
+
+void SendDataWord(u16 w) {
+  PORTC = CsNcdWr; PORTD = w / 256; PORTC = CsNcdNwr;
+  PORTC = CsNcdWr; PORTD = w % 256; PORTC = CsNcdNwr;
+}
+
+// Runs and streams of pixels are sent by the hand scheduled loops in blit.s,
+// against about 20 cycles a pixel for SendDataWord:
+//
+//   BlitFill        6.5 cycles a pixel, 4.5 when both bytes match
+//   RepeatDataWord  the same, for runs of up to 256
+//   BlitFlash       12.5 cycles a pixel, 2 byte pixels stored low byte first
+
+void BlitFill(u16 rgb, u16 count);
+void RepeatDataWord(u16 w, u8 len);  // len 0 => 256 times.
+void BlitFlash(FlashAddr pixels, u16 count);
+
+void ReleaseLcd() {
+  PORTC = LcdIdle;  // CS and CD both go inactive
+}
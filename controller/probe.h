@@ -0,0 +1,77 @@
+// Probes - where the ATmega328's time goes.
+//
+// Timer 1 runs freely at 1us a count. A probe reads it with ProbeStart and
+// passes the reading to ProbeEnd, which adds the time since to its entry in
+// probes[]: count, minimum, maximum and a sum from which the average is
+// taken. Intervals of 65ms or more read modulo 65.536ms. A few probes add
+// a count of something other than time with ProbeAdd. Each probe costs
+// about 60 cycles. Read the table with dwdebug, or build with OVERLAY set
+// (make OVERLAY=1) to have controller.c show it on the LCD.
+//
+// When a count reaches 65535 the count and sum are halved, so the average
+// follows recent behaviour. The table is cleared when the screen is
+// complete, so boot's long steps do not swamp it.
+//
+// Included before lcd.h (or host/lcdemu.h), as the probes cover the
+// drawing primitives in ui.h as well as the main loop and the radio.
+
+#ifndef PROBES
+#define PROBES 1
+#endif
+
+#ifndef OVERLAY
+#define OVERLAY 0
+#endif
+
+#define PROBECYCLE   0  // Cycle: one slice of the most urgent task
+#define PROBERADIO   1  // RadioTask building and queueing a colour packet
+#define PROBESEND    2  // Packet loaded into the empty TX FIFO to the FIFO seen empty again
+#define PROBESPI     3  // SpiInterrupt
+#define PROBECOLOUR  4  // ColourTask applying a knob turn
+#define PROBESLICE   5  // PointerSlice: one span of a pointer redraw
+#define PROBEPOINTER 6  // Pointer redraw, StartPointer to the last slice
+#define PROBESTEPS   7  // Steps covered by each pointer redraw, not time
+#define PROBERING    8  // PlotRing
+#define PROBEALPHA   9  // RenderAlphaMap, RenderText
+#define PROBEFILL   10  // FillColour
+#define PROBEEFFECT 11  // AnimateTask drawing and queueing an effect frame
+#define NPROBES     12
+
+struct probe {u16 count, min, max; u32 sum;};
+
+#if PROBES
+
+struct probe probes[NPROBES];
+
+u16 ProbeStart() {u8 sreg = SREG; cli(); u16 t = TCNT1; SREG = sreg; return t;}
+
+void ProbeAdd(u8 i, u16 value) {
+  struct probe *p = &probes[i];
+  u8 sreg = SREG;  cli();
+  if (p->count == 0xFFFF) {p->count >>= 1;  p->sum >>= 1;}
+  if (!p->count  ||  value < p->min) p->min = value;
+  if (value > p->max) p->max = value;
+  p->sum += value;
+  p->count++;
+  SREG = sreg;
+}
+
+void ProbeEnd(u8 i, u16 start) {ProbeAdd(i, ProbeStart() - start);}
+
+void ProbeClear() {
+  u8 *b = (u8*)probes;
+  for (u16 i=0; i<sizeof probes; i++) b[i] = 0;
+}
+
+#else
+
+#define ProbeStart()         0
+#define ProbeAdd(i, value)   ((void)(value))
+#define ProbeEnd(i, start)   ((void)(start))
+#define ProbeClear()
+
+#endif
+
+#if OVERLAY  &&  !PROBES
+#error The overlay shows the probe table: OVERLAY needs PROBES
+#endif
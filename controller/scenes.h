@@ -0,0 +1,95 @@
+// Scenes - colours of all four strips kept in eeprom.
+//
+// The controller keeps SCENES scenes, each colours[][] as it was stored,
+// and each strip keeps its own colour for the same scenes (see ledstrip.s).
+// Recalling a scene takes one short packet, the strips fading to their own
+// copies, while the controller loads its copy to show on the knobs. The
+// scene last stored or recalled is loaded again at power up, by both.
+//
+// Eeprom layout:
+//
+//   0..15      ring of scenes stored or recalled
+//   16+17s..   scene s: colours[][], then 0 once stored. Erased eeprom
+//              reads 0xFF, marking a scene never stored.
+//
+// Writes are made a byte at a time by EepromStep, each taking 3.4ms while
+// the main loop carries on, and only where the byte differs. Storing the
+// scene already being written replaces the bytes not yet written, so a
+// burst of stores costs one write of each byte that changed. Storing
+// another scene, or loading one, first finishes the writes.
+//
+// Each scene stored or recalled is appended to the ring, so each of its
+// bytes is written once per RINGSIZE scene changes. Bit 7 of an entry is
+// the pass round the ring that wrote it, alternately 0 and 1: the last entry
+// is the one before the first whose bit 7 differs from entry 0's, or the
+// last in the ring if none does.
+//
+// The includer provides the eeprom access: EepromBusy, EepromRead, which
+// waits while busy, and EepromWrite, called only when not busy.
+
+#define SCENES    16
+#define SCENESIZE 17   // colours[][], then 0 once stored
+#define RINGSIZE  16
+#define EERING    0
+#define EESCENES  16
+#define NOSCENE   0xFF
+
+struct {u8 scene, next, data[SCENESIZE];} store = {.scene = NOSCENE};  // Scene being written
+u8 ringentry = NOSCENE;  // Scene to append to the ring
+u8 ringslot;             // Next entry
+u8 ringpass;             // Bit 7 for this pass
+u8 lastscene = NOSCENE;  // Scene last stored or recalled
+
+
+u8 EepromUpdate(u16 address, u8 value) { // Returns whether a write was started
+  if (EepromRead(address) == value) return 0;
+  EepromWrite(address, value);
+  return 1;
+}
+
+u8 EepromStep() { // Returns whether a write was started
+  if (EepromBusy()) return 0;
+  while (store.scene != NOSCENE) {
+    if (store.next >= SCENESIZE) {store.scene = NOSCENE;  break;}
+    u8 i = store.next++;
+    if (EepromUpdate(EESCENES + store.scene*SCENESIZE + i, store.data[i])) return 1;
+  }
+  if (ringentry == NOSCENE) return 0;
+  u8 slot = ringslot, entry = ringentry | ringpass;
+  ringentry = NOSCENE;
+  if (++ringslot == RINGSIZE) {ringslot = 0;  ringpass ^= 0x80;}
+  return EepromUpdate(EERING + slot, entry);
+}
+
+void EepromFlush() { // Finish writing any scene being stored
+  while (store.scene != NOSCENE) EepromStep();
+}
+
+void FindRing() { // Sets lastscene, and where the next entry goes
+  u8 pass = EepromRead(EERING) & 0x80, i = 1;
+  while (i < RINGSIZE  &&  (EepromRead(EERING+i) & 0x80) == pass) i++;
+  lastscene = EepromRead(EERING+i-1) & 0x7F;
+  if (lastscene >= SCENES) lastscene = NOSCENE;
+  if (i == RINGSIZE) {i = 0;  pass ^= 0x80;}  // Ring full this pass, start the next
+  ringslot = i;
+  ringpass = pass;
+}
+
+void LogScene(u8 scene) {lastscene = ringentry = scene;}
+
+void SaveScene(u8 scene, const u8 *colours) { // SCENESIZE-1 bytes
+  if (store.scene != scene) EepromFlush();
+  for (u8 i=0; i<SCENESIZE-1; i++) store.data[i] = colours[i];
+  store.data[SCENESIZE-1] = 0;
+  store.scene = scene;
+  store.next  = 0;
+  LogScene(scene);
+}
+
+u8 LoadScene(u8 scene, u8 *colours) { // Returns 0, leaving colours alone, if never stored
+  EepromFlush();
+  u16 address = EESCENES + scene*SCENESIZE;
+  if (EepromRead(address + SCENESIZE-1)) return 0;
+  for (u8 i=0; i<SCENESIZE-1; i++) colours[i] = EepromRead(address + i);
+  return 1;
+}
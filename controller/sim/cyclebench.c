@@ -0,0 +1,82 @@
+// cyclebench - time sim/kernels.elf's benchmarks in ATmega328 cycles
+// under simavr.
+//
+// Usage: cyclebench kernels.elf
+//
+// Cycles are counted from each write of a benchmark number to GPIOR0 to
+// the write of 0 that ends it, and divided by the number of calls made.
+// Per call figures include kernels.c's loop, whose own cost is the first
+// line.
+//
+// Not yet run under simavr: no cycle counts have been taken with it.
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+
+#define GPIOR0 0x3E  // Data space address
+
+#define NBENCH 21
+
+const struct {const char *name; int calls;} bench[NBENCH] = {
+  {"", 0},
+  {"Loop and store",                256},
+  {"u6sqrt",                        256},
+  {"Sqrt12",                        256},
+  {"AlphaMultiplyChannel",          256},
+  {"BlendChannel",                  256},
+  {"AlphaMultiplyPixel",            256},
+  {"BlendPixel",                    256},
+  {"Sine",                          256},
+  {"GetVec",                        256},
+  {"PlotHollowCircle r46 t8",       1},
+  {"PlotPartLine pointer",          17},
+  {"DrawPointer",                   17},
+  {"Ramp",                          256},
+  {"RenderAlphaMap am1",            1},
+  {"scale r46 t8 with ticks",       1},
+  {"FillColour 320x480 black",      1},
+  {"FillColour 320x480 0xFA20",     1},
+  {"BlitFlash 64 pixels",           1},
+  {"RenderText icon a",             1},
+  {"RenderText 30 characters",      1},
+};
+
+uint64_t cycles[NBENCH];
+avr_t   *avr;
+int      current;
+uint64_t started;
+
+void Marker(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param) {
+  (void)addr; (void)param;
+  if (v  &&  v < NBENCH) {current = v; started = avr->cycle;}
+  else if (!v  &&  current) {cycles[current] = avr->cycle - started; current = 0;}
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {fprintf(stderr, "Usage: cyclebench kernels.elf\n"); return 2;}
+
+  static elf_firmware_t firmware;
+  if (elf_read_firmware(argv[1], &firmware)) {fprintf(stderr, "Cannot read %s.\n", argv[1]); return 2;}
+  avr = avr_make_mcu_by_name(firmware.mmcu[0] ? firmware.mmcu : "atmega328p");
+  if (!avr) {fprintf(stderr, "simavr has no %s.\n", firmware.mmcu); return 2;}
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->frequency = 8000000;
+  avr_register_io_write(avr, GPIOR0, Marker, NULL);
+
+  int state;
+  do state = avr_run(avr); while (state != cpu_Done  &&  state != cpu_Crashed);
+  if (state == cpu_Crashed) {fprintf(stderr, "Simulation crashed.\n"); return 1;}
+
+  fprintf(stdout, "%-34s %10s %10s %10s\n", "", "calls", "cycles", "per call");
+  for (int i=1; i<NBENCH; i++) {
+    if (!cycles[i]) {fprintf(stderr, "%s did not run.\n", bench[i].name); return 1;}
+    fprintf(stdout, "%-34s %10d %10lu %10.1f\n", bench[i].name, bench[i].calls,
+      (unsigned long)cycles[i], (double)cycles[i] / bench[i].calls);
+  }
+  return 0;
+}
@@ -0,0 +1,65 @@
+// kernels - run ui.h's maths kernels on the ATmega328 for sim/cyclebench.
+//
+// Each benchmark writes its number to GPIOR0 as it starts and 0 as it
+// ends, and cyclebench times the interval under simavr. Results go to a
+// volatile so that the calls are not optimised away. The drawing kernels
+// drive the LCD bus ports as on the device, with nothing attached.
+
+#define printf(...)
+#define PROBES 0  // Kernel timings without the probes' overhead
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+#define countof(a) (sizeof(a)/sizeof(0[a]))
+
+typedef uint8_t   u8;   typedef int8_t    s8;
+typedef uint16_t  u16;  typedef int16_t   s16;
+typedef uint32_t  u32;
+
+typedef uint16_t FlashAddr;
+
+#include "../probe.h"
+#include "../lcd.h"
+#define PLOTLINE 1  // ui.h's line plotter, for the pointers
+#include "../ui.h"
+#include "../font.h"
+#include "../icons.h"
+
+volatile u16 sink;
+
+#define Bench(n, ...) do {GPIOR0 = n; __VA_ARGS__; GPIOR0 = 0;} while (0)
+
+int main() {
+  s16 dx, dy;
+  u16 i;
+
+  // Numbered as in cyclebench.c
+  Bench(1,  for (i=0; i<256; i++) sink = i);
+  Bench(2,  for (i=0; i<4096; i+=16) sink = u6sqrt(i));
+  Bench(3,  for (i=0; i<4096; i+=16) sink = Sqrt12(i));
+  Bench(4,  for (i=0; i<256; i++) sink = AlphaMultiplyChannel(i & 63, i >> 2));
+  Bench(5,  for (i=0; i<256; i++) sink = BlendChannel(i & 63, 63 - (i & 63), i >> 2));
+  Bench(6,  for (i=0; i<256; i++) sink = AlphaMultiplyPixel(i * 257, i >> 2));
+  Bench(7,  for (i=0; i<256; i++) sink = BlendPixel(WHITE, i * 257, i >> 2));
+  Bench(8,  for (i=0; i<256; i++) sink = Sine(i));
+  Bench(9,  for (i=0; i<256; i++) {GetVec(i, &dx, &dy); sink = dx + dy;});
+  Bench(10, paint = WHITE; PlotHollowCircle(260, 60, 46, 8));
+  Bench(11, foreground = WHITE; background = BLACK;
+            for (i=0; i<=256; i+=16) {GetVec(i, &dx, &dy); PlotPartLine(260, 60, dx, dy, (dx*5)/256, (dy*5)/256, (dx*35)/256, (dy*35)/256);});
+  Bench(12, for (i=0; i<=256; i+=16) DrawPointer(260, 60, i, WHITE));
+  Bench(13, for (i=0; i<256; i++) sink = Ramp(WHITE, 0xFA20, i >> 2));
+  Bench(14, paint = WHITE; RenderAlphaMap(10, 10, am1));
+  Bench(15, scale(260, 60, 0xFA20));
+  Bench(16, FillColour(0, 0, 320, 480, BLACK));
+  Bench(17, FillColour(0, 0, 320, 480, 0xFA20));
+  Bench(18, WriteRegion(0, 0, 7, 7); BlitFlash((FlashAddr)squares, 64); ReleaseLcd());
+  Bench(19, paint = WHITE; RenderText(10, 10, icons, "a"));
+  Bench(20, paint = WHITE; RenderText(4, 24, font, "PROBE  COUNT   MIN   AVG   MAX"));
+
+  cli();  sleep_enable();  sleep_cpu();  // simavr stops
+  return 0;
+}
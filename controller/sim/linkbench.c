@@ -0,0 +1,215 @@
+// linkbench - run controller.elf and ledstrip.elf together under simavr,
+// joined by ../ledstrip/sim/nrfsim.h's air, and time knob turns to light.
+//
+// Usage: linkbench controller.elf ledstrip.elf [loss%] [delay us]
+//
+// The two chips run in lockstep, whichever is behind executing next, so
+// their clocks stay within an instruction of each other. The air may lose a
+// given percentage of packets and ACKs and delay each by a given number of
+// us. ACKs delayed past the controller's retransmit delay (ARD) are missed
+// and the packet sent again.
+//
+// After both have booted, and the strip shows the controller's colours, the
+// red knob is turned TURNS times, alternately up and down, each turn a burst
+// of DETENTS detents DETENTMS apart on PB0/PB1, with gaps of varying length
+// between turns so that they meet the controller's GLIDE timing at
+// different phases. The strip's first pixel is decoded from PB4, and for
+// each turn the bench reports the time from its first detent to:
+//
+//   first change   the first frame whose red differs from before the turn
+//   settled        the first frame showing the red the strip settles on
+//
+// and the controller's acknowledgements, retries, and the telemetry from
+// the strip's last ACK payload.
+//
+// Fails if any packet reaches a strip that disagrees with the controller on
+// channel, data rate, CRC, payload width or ACKs, if no telemetry comes
+// back, if a turn changes nothing, retries making up for any loss, or if,
+// with no loss, a turn moves red the wrong way. Strip 0 is the only strip,
+// so the packets to strips 1 to 3 are counted as address mismatches, which
+// are not failures; its own address is checked by its ACKs.
+//
+// Unverified: written and syntax checked without simavr, and never yet
+// run, so there are no measured turn-to-light times to quote.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "avr_ioport.h"
+#include "avr_eeprom.h"
+
+#include "nrfsim.h"
+
+#define MHZ      8
+#define NS(c)    ((c) * 1000 / MHZ)    // Cycles to ns
+#define MS(m)    ((uint64_t)(m) * 1000 * MHZ)
+#define RESET    (80 * MHZ)            // SK6812 reset: 80us low
+#define BOOT     MS(1500)              // Both booted and the strip faded to the boot colours
+#define TURNS    12
+#define DETENTS  4
+#define DETENTMS 5
+#define QUIET    MS(400)               // Red unchanged for this long is settled
+#define TIMEOUT  MS(2000)
+
+avr_t      *ctl, *led;
+struct nrf  ctlnrf, lednrf;
+struct spi  spi;
+struct usi  usi;
+struct air  air;
+avr_irq_t  *knob[2];
+int         failures;
+
+void Fail(const char *format, uint64_t a, uint64_t b) {
+  if (failures++ < 10) {fprintf(stderr, format, a, b); fputc('\n', stderr);}
+}
+
+
+// PB4 decoded to the first pixel's red, frame by frame
+
+uint64_t rise, fall, framestart;
+int      level, bits, red = -1;        // Red of the last complete frame
+uint8_t  shift;
+uint64_t redat;                        // Start of the frame at which red last changed
+
+void Led(avr_irq_t *irq, uint32_t value, void *param) {
+  (void)irq; (void)param;
+  if (value == (uint32_t)level) return;
+  level = value;
+  if (value) {
+    if (led->cycle - fall >= RESET) {bits = 0;  framestart = led->cycle;}
+    rise = led->cycle;
+  } else {
+    shift = shift << 1 | (NS(led->cycle - rise) > 450);  // 1 bits are high for longer
+    if (++bits == 16) {                // Green then red
+      if (shift != red) {red = shift;  redat = framestart;}
+    }
+    fall = led->cycle;
+  }
+}
+
+
+// Simulation
+
+void Run(uint64_t until) { // Controller cycles
+  while (ctl->cycle < until) {
+    avr_t *next = ctl->cycle <= led->cycle ? ctl : led;
+    int state = avr_run(next);
+    if (state == cpu_Done  ||  state == cpu_Crashed) {fprintf(stderr, "%s stopped.\n", next == ctl ? "Controller" : "Ledstrip"); exit(2);}
+  }
+}
+
+avr_t *Load(const char *elf, const char *mcu) {
+  static elf_firmware_t firmware[2];
+  static int loaded;
+  elf_firmware_t *f = &firmware[loaded++];
+  if (elf_read_firmware(elf, f)) {fprintf(stderr, "Cannot read %s.\n", elf); exit(2);}
+  avr_t *avr = avr_make_mcu_by_name(mcu);
+  if (!avr) {fprintf(stderr, "simavr has no %s.\n", mcu); exit(2);}
+  avr_init(avr);
+  avr_load_firmware(avr, f);
+  avr->frequency = MHZ * 1000000;
+  return avr;
+}
+
+void Phase(int phase) { // Knob pins PB0 and PB1
+  avr_raise_irq(knob[0], phase & 1);
+  avr_raise_irq(knob[1], phase >> 1 & 1);
+}
+
+void Detent(int up) {
+  const char *seq = up ? "1023" : "2013";
+  for (; *seq; seq++) {Phase(*seq - '0');  Run(ctl->cycle + MS(DETENTMS)/4);}
+}
+
+struct stat {uint64_t min, max, sum; int n;};
+
+void Add(struct stat *s, uint64_t v) {
+  if (!s->n  ||  v < s->min) s->min = v;
+  if (v > s->max) s->max = v;
+  s->sum += v;  s->n++;
+}
+
+void Report(const char *name, struct stat *s) {
+  if (!s->n) {fprintf(stdout, "%-28s %10s\n", name, "none");  return;}
+  fprintf(stdout, "%-28s %10.2f %10.2f %10.2f ms\n", name,
+    s->min / (MHZ*1000.0), s->sum / (double)s->n / (MHZ*1000.0), s->max / (MHZ*1000.0));
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {fprintf(stderr, "Usage: linkbench controller.elf ledstrip.elf [loss%%] [delay us]\n"); return 2;}
+  air.loss  = argc > 3 ? atof(argv[3]) * 65536 / 100 : 0;
+  air.delay = argc > 4 ? atoi(argv[4]) : 0;
+  air.seed  = 1;
+
+  ctl = Load(argv[1], "atmega328");
+  led = Load(argv[2], "attiny85");
+
+  uint8_t eeprom[256];                 // Strip 0, dark until told, no scenes
+  memset(eeprom, 0xFF, sizeof eeprom);
+  memset(eeprom, 0, 6);
+  avr_eeprom_desc_t ee = {.ee = eeprom, .offset = 0, .size = sizeof eeprom};
+  avr_ioctl(led, AVR_IOCTL_EEPROM_SET, &ee);
+
+  NrfReset(&ctlnrf);  NrfReset(&lednrf);
+  NrfAttachSpi(ctl, &spi, &ctlnrf, 'B', 2, -1);  // IRQ not wired, STATUS is polled
+  NrfAttachUsi(led, &usi, &lednrf, 'B', 3);
+  NrfJoin(&air, &ctlnrf);  NrfJoin(&air, &lednrf);
+
+  for (int i=0; i<2; i++) knob[i] = avr_io_getirq(ctl, AVR_IOCTL_IOPORT_GETIRQ('B'), i);
+  avr_raise_irq(avr_io_getirq(ctl, AVR_IOCTL_IOPORT_GETIRQ('B'), 7), 1);  // Switch released
+  Phase(3);
+  avr_irq_register_notify(avr_io_getirq(led, AVR_IOCTL_IOPORT_GETIRQ('B'), 4), Led, NULL);
+
+  Run(BOOT);
+  if (red < 0) {Fail("No LED frames after %lu ms.", BOOT / MS(1), 0);  return 1;}
+  if (!ctlnrf.sent) Fail("Controller sent nothing in %lu ms.", BOOT / MS(1), 0);
+
+  struct stat change = {0}, settle = {0};
+  int unchanged = 0, wrongway = 0;
+  uint32_t gap = 1;
+  for (int turn=0; turn<TURNS; turn++) {
+    int up = !(turn & 1), before = red;
+    uint64_t start = ctl->cycle;
+    for (int d=0; d<DETENTS; d++) Detent(up);
+    // Wait for the first change, then until red has been steady for QUIET
+    while (red == before  &&  ctl->cycle - start < TIMEOUT) Run(ctl->cycle + MS(1));
+    if (red == before) {unchanged++;  continue;}
+    Add(&change, redat - start);
+    while (ctl->cycle - redat < QUIET) Run(ctl->cycle + MS(1));
+    Add(&settle, redat - start);
+    if (up ? red < before : red > before) wrongway++;
+    gap = gap * 1103515245 + 12345;
+    Run(ctl->cycle + MS(50 + (gap >> 16) % 200));
+  }
+
+  fprintf(stdout, "%-28s %10s %10s %10s\n", "Detent to", "min", "avg", "max");
+  Report("first change", &change);
+  Report("settled", &settle);
+  fprintf(stdout, "%-28s %10lu\n", "Packets sent", (unsigned long)air.sent);
+  fprintf(stdout, "%-28s %10lu\n", "Packets lost in the air", (unsigned long)air.lost);
+  fprintf(stdout, "%-28s %10lu\n", "Packets delivered", (unsigned long)air.delivered);
+  fprintf(stdout, "%-28s %10lu\n", "Retransmissions", (unsigned long)ctlnrf.retransmits);
+  fprintf(stdout, "%-28s %10lu\n", "Retransmissions repeated", (unsigned long)air.repeats);
+  fprintf(stdout, "%-28s %10lu\n", "Packets acknowledged", (unsigned long)ctlnrf.acked);
+  fprintf(stdout, "%-28s %10lu\n", "Packets reaching MAX_RT", (unsigned long)ctlnrf.failed);
+  fprintf(stdout, "%-28s %10lu\n", "ACKs sent by the strip", (unsigned long)lednrf.acks);
+  const uint8_t *t = ctlnrf.lastack.data;
+  fprintf(stdout, "%-28s %10d %10d %10d\n", "Telemetry seq, us, overflows", t[0], t[1] * 128, t[2]);
+  for (int r=0; r<NRFREASONS; r++)
+    if (air.mismatch[r]) fprintf(stdout, "%-28s %10lu\n", nrfreason[r], (unsigned long)air.mismatch[r]);
+  fprintf(stdout, "%-28s %10d\n", "Turns not shown", unchanged);
+
+  for (int r=1; r<NRFREASONS-1; r++)   // Not listening and FIFO full are timing, not settings,
+    if (air.mismatch[r]  &&  r != 4)   // and address mismatches are packets to the absent strips
+      {fprintf(stderr, "Packets dropped for %s mismatch.\n", nrfreason[r]);  failures++;}
+  if (ctlnrf.lastack.len != 3) Fail("No telemetry returned, last ACK payload %lu bytes.", ctlnrf.lastack.len, 0);
+  if (unchanged) Fail("%lu turns not shown.", unchanged, 0);
+  if (!air.loss  &&  wrongway) Fail("%lu turns moved red the wrong way.", wrongway, 0);
+
+  if (failures) {fprintf(stderr, "linkbench: %d failures.\n", failures); return 1;}
+  return 0;
+}
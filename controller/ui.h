@@ -8,44 +8,46 @@
 #define WHITE   0xFFFF
 
 
+void WriteRegion(u16 x0, u16 y0, u16 x1, u16 y1) {
+  SendCommand(0x2A); SendDataWord(x0); SendDataWord(x1);
+  SendCommand(0x2B); SendDataWord(y0); SendDataWord(y1);
+  SendCommand(0x2C);
+}
+
 void FillColour(u16 x, u16 y, u16 w, u16 h, u16 rgb) {
-  u8 l;
+  u16 probe = ProbeStart();
   WriteRegion(x, y, x+w-1, y+h-1);
-
-  while(h) {
-    l = w>>8;  while (l) {RepeatDataWord(rgb, 0); l--;}
-    l = w&255; while (l) {SendDataWord(rgb); l--;}
-    h--;
-  }
-
-  PORTC = LcdIdle;  // CS and CD both go inactive
+  while (h) {BlitFill(rgb, w); h--;}
+  ReleaseLcd();
+  ProbeEnd(PROBEFILL, probe);
 }
 
 
 
-u16 AlphaMultiplyChannel(u8 p, u8 a) { // reduce gamma encoded 6 bit pixel p by 6 bit linear gamma a.
-  return ((p*p)/4) * a;
-}
+// Gamma encoded channel maths is done by table lookup. The tables are
+// generated by host/blendgen from the reference kernels in gamma.h:
+//
+//   squares[p] = AlphaMultiplyChannel(p, 1), i.e. (p*p)/4
+//   sqrt12[n]  = u6sqrt(n)
 
+#include "gamma.h"
+#include "blendtables.h"
 
-//u16 AlphaMultiplyChannel(u8 level, u8 alpha) { // level in sqrt space, alpha and result in linear space
-//  u16 n1 = (alpha * level) / 2;     // 11 bit
-//  u16 n2 = (n1/2) * level;          // 16 bit
-//  return n1 + n2;                   // 16 bit
-//}
+u16 SquareChannel(u8 p) {return __LPM_word((FlashAddr)(squares+p));}
+u8  Sqrt12(u16 n)       {return __LPM((FlashAddr)(sqrt12+n));}
 
 u16 AlphaMultiplyPixel(u16 pixel, u8 alpha) { // 565 rgb pixel * 6 bit alpha
   if (alpha >= 63) return pixel;
   return
-    ((u6sqrt(AlphaMultiplyChannel((pixel >> 10) & 0x3E, alpha) >> 4) & 0x3E) << 10)
-  | ( u6sqrt(AlphaMultiplyChannel((pixel >>  5) & 0x3F, alpha) >> 4)         << 5)
-  | ( u6sqrt(AlphaMultiplyChannel((pixel <<  1) & 0x3E, alpha) >> 4)         >> 1);
+    ((Sqrt12((SquareChannel((pixel >> 10) & 0x3E) * alpha) >> 4) & 0x3E) << 10)
+  | ( Sqrt12((SquareChannel((pixel >>  5) & 0x3F) * alpha) >> 4)         << 5)
+  | ( Sqrt12((SquareChannel((pixel <<  1) & 0x3E) * alpha) >> 4)         >> 1);
 }
 
 
 u8 BlendChannel(u8 fg, u8 bg, u8 alpha) {
-  u8 blend = u6sqrt((  AlphaMultiplyChannel(fg, alpha)
-                    + AlphaMultiplyChannel(bg, 63-alpha)) >> 4);
+  u8 blend = Sqrt12((  SquareChannel(fg) * alpha
+                    + SquareChannel(bg) * (63-alpha)) >> 4);
   //printf("  BlendChannel(fg %02x, bg %02x, alpha %02x) -> %02x.\n", fg, bg, alpha, blend);
   return blend;
 }
@@ -68,11 +70,46 @@ u16 BlendPixel(u16 fg, u16 bg, u8 alpha) {
 }
 
 
+// Only 64 alpha levels exist for a given foreground and background, so the
+// primitives read blended pixels from a ramp of them, filled in as each
+// level is first used. Two ramps are kept, so that a pass drawing in two
+// pairs does not refill them; a new pair replaces the one used less recently.
+// Paint alone over black is the pair (paint, BLACK).
+
+#define RAMPS 2
+
+u16 rampfg[RAMPS], rampbg[RAMPS];
+u16 ramp[RAMPS][64];
+u8  rampset[RAMPS][8];  // Bit per ramp entry filled
+u8  ramplast;           // Ramp used most recently
+
+u16 Ramp(u16 fg, u16 bg, u8 alpha) {
+  if (alpha >= 63) return fg;
+  u8 r = ramplast;
+  if (fg != rampfg[r]  ||  bg != rampbg[r]  ||  !rampset[r][0]) { // Entry 0 is filled with each new pair
+    r ^= 1;
+    if (fg != rampfg[r]  ||  bg != rampbg[r]  ||  !rampset[r][0]) {
+      for (u8 i=1; i<8; i++) rampset[r][i] = 0;
+      rampfg[r] = fg;  rampbg[r] = bg;
+      ramp[r][0] = BlendPixel(fg, bg, 0);  rampset[r][0] = 1;
+    }
+    ramplast = r;
+  }
+  u8 bit = 1 << (alpha & 7);
+  if (!(rampset[r][alpha >> 3] & bit)) {
+    ramp[r][alpha] = BlendPixel(fg, bg, alpha);
+    rampset[r][alpha >> 3] |= bit;
+  }
+  return ramp[r][alpha];
+}
+
+
 
 u16 paint = YELLOW;
 
 void RenderAlphaMap(u16 x, u16 y, const u8 *map) {
 
+  u16 probe = ProbeStart();
   u16 w = __LPM_word((FlashAddr)(map)); map += 2;
   u16 h = __LPM_word((FlashAddr)(map)); map += 2;
 
@@ -91,15 +128,14 @@ void RenderAlphaMap(u16 x, u16 y, const u8 *map) {
       case 0x80: alpha = 0x3F;  len &= 0x3F; break;
     }
 
-    u16 rgb = AlphaMultiplyPixel(paint, alpha);
-    //printf("AlphaMultiplyPixel(paint %04x x alpha %02x) = %04x.\n", paint, alpha, rgb);
-    RepeatDataWord(rgb, len);
+    RepeatDataWord(Ramp(paint, BLACK, alpha), len);
 
     len = __LPM((FlashAddr)(map++)); // *(map++);
     code = len & 0xC0;
   }
 
-  PORTC = LcdIdle;  // CS remains active, CD goes high to return to data mode
+  ReleaseLcd();
+  ProbeEnd(PROBEALPHA, probe);
 }
 
 
@@ -114,6 +150,122 @@ const u8 PROGMEM /*__attribute__((__progmem__))*/ am1[] = {
 };
 
 
+// Alpha map atlases (v2), generated by host/atlasgen from PBM and PGM
+// images. An atlas is one PROGMEM array:
+//
+//   0          height of every glyph
+//   1          clear columns after each glyph
+//   2, 3       first character, and count of characters from it
+//   4+3c..     character first+c: offset of its glyph from the atlas start,
+//              low byte first, and its width
+//   ..         glyphs, each its pixels row after row as codes of
+//
+//     00nnnnnn            n+1 clear pixels
+//     01nnnnnn            n+1 solid pixels
+//     10nnnnnn a a ...    n+1 partial alphas, 4 bits each, high nibble first
+//     11snnnnn nnnnnnnn   n+1 clear (s 0) or solid (s 1) pixels
+//
+// Runs may cross rows, and a glyph ends after width*height pixels.
+//
+// RenderText writes a string TEXTMAX characters at a time, each group as
+// one region, a row at a time across every glyph, so each glyph keeps a
+// cursor into its codes between rows. The cursors are on the stack, so
+// TEXTMAX bounds it. Equal pixels, such as a glyph's clear columns and the
+// gap and clear columns of the next, are sent as one RepeatDataWord.
+
+#define ALPHACLEAR 0x00
+#define ALPHASOLID 0x40
+#define ALPHAPART  0x80
+#define ALPHALONG  0xC0
+#define TEXTMAX    8    // Characters drawn as one region
+
+struct alphacursor {
+  FlashAddr code;       // Next byte of the glyph
+  u16 run;              // Pixels left of the current code
+  u8  op;               // ALPHACLEAR, ALPHASOLID or ALPHAPART
+  u8  pair;             // Partials: byte holding the current two alphas
+  u8  low;              // Partials: its low nibble is next
+};
+
+u16 textrgb;            // Pixel value pending
+u8  textlen;            // Number of them pending
+
+void TextPixels(u16 rgb, u16 n) {
+  if (!n) return;
+  if (textlen  &&  rgb != textrgb) {RepeatDataWord(textrgb, textlen);  textlen = 0;}
+  textrgb = rgb;
+  while (n) {
+    u8 room = 255 - textlen,  m = n < room ? n : room;
+    textlen += m;  n -= m;
+    if (textlen == 255) {RepeatDataWord(textrgb, textlen);  textlen = 0;}
+  }
+}
+
+void GlyphRow(struct alphacursor *c, u8 w) {
+  while (w) {
+    if (!c->run) {
+      u8 b = __LPM(c->code++);
+      c->op = b & 0xC0;  c->run = (b & 0x3F) + 1;  c->low = 0;
+      if (c->op == ALPHALONG) {
+        c->op  = b & 0x20 ? ALPHASOLID : ALPHACLEAR;
+        c->run = ((b & 0x1F) << 8 | __LPM(c->code++)) + 1;
+      }
+    }
+    if (c->op == ALPHAPART) {
+      u8 a;
+      if (c->low) a = c->pair & 0x0F;
+      else        a = (c->pair = __LPM(c->code++)) >> 4;
+      c->low ^= 1;
+      TextPixels(Ramp(paint, BLACK, a << 2 | a >> 2), 1);
+      c->run--;  w--;
+    } else {
+      u8 n = c->run < w ? c->run : w;
+      TextPixels(c->op == ALPHASOLID ? paint : BLACK, n);
+      c->run -= n;  w -= n;
+    }
+  }
+}
+
+u16 RenderGlyphs(u16 x, u16 y, const u8 *atlas, const char *s, u8 n) { // Up to TEXTMAX, returns the width drawn
+  struct alphacursor cursor[TEXTMAX];
+  u8  width[TEXTMAX];
+  u8  h     = __LPM((FlashAddr)(atlas));
+  u8  gap   = __LPM((FlashAddr)(atlas+1));
+  u8  first = __LPM((FlashAddr)(atlas+2));
+  u8  count = __LPM((FlashAddr)(atlas+3));
+  u16 w = 0;
+  u8  i, row;
+
+  for (i=0; i<n; i++) {  // Characters outside the atlas draw as its first
+    u8 c = s[i] - first;  if (c >= count) c = 0;
+    FlashAddr m = (FlashAddr)(atlas + 4 + 3*c);
+    cursor[i].code = (FlashAddr)atlas + __LPM_word(m);
+    cursor[i].run  = 0;
+    width[i] = __LPM(m+2);
+    w += width[i] + gap;
+  }
+  if (!w) return 0;
+
+  WriteRegion(x, y, x+w-1, y+h-1);
+  for (row=0; row<h; row++) for (i=0; i<n; i++) {GlyphRow(cursor+i, width[i]);  TextPixels(BLACK, gap);}
+  if (textlen) {RepeatDataWord(textrgb, textlen);  textlen = 0;}
+  ReleaseLcd();
+  return w;
+}
+
+u16 RenderText(u16 x, u16 y, const u8 *atlas, const char *s) { // In paint over black, returns the width drawn
+  u16 probe = ProbeStart();
+  u16 w = 0;
+  u8  n;
+  for (; *s; s += n) {
+    for (n=0; s[n]  &&  n < TEXTMAX; n++);
+    w += RenderGlyphs(x+w, y, atlas, s, n);
+  }
+  ProbeEnd(PROBEALPHA, probe);
+  return w;
+}
+
+
 
 #define HORZ 0
 #define VERT 1
@@ -133,23 +285,20 @@ void PixelRunAlpha(
   u16 paint1;
   u16 paint2;
   u16 paint3;
-  u16 i;
   //u8 hi, lo;
 
-  paint1 = AlphaMultiplyPixel(paint, alpha1);
-  paint2 = AlphaMultiplyPixel(paint, alpha2);
-  if (alpha3 == alpha1) paint3 = paint1;
-  else paint3 = AlphaMultiplyPixel(paint, alpha3);
+  paint1 = Ramp(paint, BLACK, alpha1);
+  paint2 = Ramp(paint, BLACK, alpha2);
+  paint3 = Ramp(paint, BLACK, alpha3);
 
   // Preset write memory command bounds
 
   if (orientation == HORZ) WriteRegion(first, major, last, major);
   else                     WriteRegion(major, first, major, last);
   SendDataWord(paint1);
-  i = first+1; while (i < last) {SendDataWord(paint2); i++;}
-  if (i == last) {SendDataWord(paint3);}
+  if (last > first) {BlitFill(paint2, last-first-1);  SendDataWord(paint3);}
 
-  PORTC = LcdIdle;  // CS and CD both go inactive
+  ReleaseLcd();
 }
 
 
@@ -184,93 +333,73 @@ void PixelRunAlpha(
 
 
 
-void PlotHollowCircle(u16 cx, u16 cy, u16 r, u16 t) {
-  u16 x1,    x2,  y;
-  s16 dx1,  dx2,  dy;
-  s16 er1,  er2;
-
-  x1  = r-t;   dx1 = 1 - 2*(r-t);
-  x2  = r+t;   dx2 = 1 - 2*(r+t);
-  er1 = 0;     er2 = 0;
-  y = 0;       dy = 1;
-
-  while (x2 >= y) {
-    u8  lum1 = (x1 >= y) ? (63 - (63 * (2*er1 + dx1)) / (2*dx1)) : 63;
-    u8  lum2 = (63 * (2*er2 + dx2)) / (2*dx2);
-    u16 x1c  = (x1 >= y) ? x1 : y;
+// PlotLine
 
-    PixelRunAlpha(HORZ, cy+y, cx+x1c, cx+x2, paint, lum1, 63, lum2);
-    PixelRunAlpha(HORZ, cy+y, cx-x2, cx-x1c, paint, lum2, 63, lum1);
-    PixelRunAlpha(VERT, cx+y, cy+x1c, cy+x2, paint, lum1, 63, lum2);
-    PixelRunAlpha(VERT, cx+y, cy-x2, cy-x1c, paint, lum2, 63, lum1);
+u16 foreground, background;
 
-    if (y>0) {
-      PixelRunAlpha(HORZ, cy-y, cx+x1c, cx+x2, paint, lum1, 63, lum2);
-      PixelRunAlpha(HORZ, cy-y, cx-x2, cx-x1c, paint, lum2, 63, lum1);
-      PixelRunAlpha(VERT, cx-y, cy+x1c, cy+x2, paint, lum1, 63, lum2);
-      PixelRunAlpha(VERT, cx-y, cy-x2, cy-x1c, paint, lum2, 63, lum1);
+// PlotPartLine draws antialiased lines a pair of pixels at a time. The
+// firmware draws its pointers from sprites generated with it (see knobs.h),
+// so it is compiled only where PLOTLINE is set: host/pointergen and the
+// benches.
+
+#ifndef PLOTLINE
+#define PLOTLINE 0
+#endif
+
+#if PLOTLINE
+
+// Pixel pairs are buffered while they continue a straight run of pairs -
+// VERT pairs along a row, HORZ pairs down a column - and each run is then
+// sent as a single 2 pixel wide region, so that a line costs one region
+// setup per change of minor coordinate instead of one per major step.
+
+#define PAIRMAX 32
+
+u8  pairorientation;    // HORZ: pair is side by side, VERT: one above the other
+u16 pairx, pairy;       // Top left pixel of the first pair buffered
+s8  pairdir;            // +1/-1: direction along the run of later pairs
+u8  pairs;              // Number of pairs buffered
+u8  pairalpha[PAIRMAX]; // Alpha of the top/left pixel of each pair
+
+void FlushPairs() {
+  if (!pairs) return;
+  u8  last = pairs-1;
+  u16 first;            // Leftmost (VERT) or topmost (HORZ) coordinate of run
+  u8  i, j;
+
+  if (pairdir < 0) first = (pairorientation==VERT ? pairx : pairy) - last;
+  else             first = (pairorientation==VERT ? pairx : pairy);
+
+  if (pairorientation == VERT) {
+    WriteRegion(first, pairy, first+last, pairy+1);
+    for (i=0; i<=last; i++) {j = pairdir<0 ? last-i : i;  SendDataWord(Ramp(foreground, background, pairalpha[j]));}
+    for (i=0; i<=last; i++) {j = pairdir<0 ? last-i : i;  SendDataWord(Ramp(foreground, background, FULL-pairalpha[j]));}
+  } else {
+    WriteRegion(pairx, first, pairx+1, first+last);
+    for (i=0; i<=last; i++) {
+      j = pairdir<0 ? last-i : i;
+      SendDataWord(Ramp(foreground, background, pairalpha[j]));
+      SendDataWord(Ramp(foreground, background, FULL-pairalpha[j]));
     }
-
-    er1+=dy; if (2*er1+dx1 > 0) {x1--;  er1+=dx1; dx1+=2;}
-    er2+=dy; if (2*er2+dx2 > 0) {x2--;  er2+=dx2; dx2+=2;}
-    y++; dy += 2;
   }
+  ReleaseLcd();
+  pairs = 0;
 }
 
-
-// PlotLine
-
-u16 foreground, background;
-
 void PaintPair(u8 orientation, u16 x, u16 y, u8 alpha) {
-  WriteRegion(x, y, x + (orientation==HORZ), y + (orientation==VERT));
-  //SendDataWord(AlphaMultiplyPixel(paint, alpha));
-  //SendDataWord(AlphaMultiplyPixel(paint, FULL-alpha));
-  SendDataWord(BlendPixel(foreground, background, alpha));
-  SendDataWord(BlendPixel(foreground, background, FULL-alpha));
-  PORTC = LcdIdle;     // CS and CD both go inactive
+  if (pairs) {
+    // Offset of this pair along the run and across it from the first pair
+    s16 along  = orientation==VERT ? x-pairx : y-pairy;
+    s16 across = orientation==VERT ? y-pairy : x-pairx;
+    if (pairs == 1  &&  (along == 1 || along == -1)) pairdir = along;
+    if (orientation != pairorientation  ||  across != 0
+    ||  along != pairdir*pairs  ||  pairs >= PAIRMAX) FlushPairs();
+  }
+  if (!pairs) {pairorientation = orientation; pairx = x; pairy = y; pairdir = 0;}
+  pairalpha[pairs++] = alpha;
 }
 
 
-//  void PlotLine(u16 x0, u16 y0,  s16 dx, s16 dy) {
-//    s8 sx = 1, sy = 1;
-//    if (dx < 0) {dx = -dx; sx = -1;}
-//    if (dy < 0) {dy = -dy; sy = -1;}
-//    u8 swap = dx<dy; if (swap) {s16 t=dx; dx=dy; dy=t;}
-//    u16 D = 0;
-//    u16 x = 0;
-//    u16 y = 0;
-//    u16 xp, yp;
-//    s8 xi, yi;
-//
-//    while (x <= (u16)dx) {
-//      int next = (FULL*D)/dx;
-//
-//      if (!swap) {xp=x; yp=y; xi=0;  yi=sy;}
-//      else       {xp=y; yp=x; xi=sx; yi=0;}
-//
-//      xp = (sx < 0) ? x0-xp : x0+xp;
-//      yp = (sy < 0) ? y0-yp : y0+yp;
-//
-//      if (xi == 0) {
-//        if (yi < 0) PaintPair(VERT, xp, yp-1, next);
-//        else        PaintPair(VERT, xp, yp,   FULL-next);
-//      } else {
-//        if (xi < 0) PaintPair(HORZ, xp-1, yp, next);
-//        else        PaintPair(HORZ, xp, yp,   FULL-next);
-//      }
-//
-//      D += dy;
-//
-//      if (D >= (u16)dx) {
-//        y++;
-//        D -= dx;
-//      }
-//
-//      x++;
-//    }
-//  }
-
 void PlotPartLine(u16 x0, u16 y0,  s16 dx, s16 dy, s16 minx, s16 miny, s16 maxx, s16 maxy) {
 
   //printf("x0 %d, y0 %d, dx %d, dy %d, minx %d, miny %d, maxx %d, maxy %d",
@@ -287,6 +416,13 @@ void PlotPartLine(u16 x0, u16 y0,  s16 dx, s16 dy, s16 minx, s16 miny, s16 maxx,
   u16 xp, yp;
   s8 xi, yi;
 
+  // Coverage FULL*D/dx is carried as quotient and remainder, stepped by
+  // FULL*dy/dx each pixel, so that only this setup divides.
+  u8  alpha = 0;
+  u16 rest  = 0;                                  // FULL*D - alpha*dx
+  u8  step  = dx ? (FULL*dy) / dx : 0;
+  u16 stepr = dx ? (FULL*dy) % dx : 0;
+
   //printf(" --> minx %d, maxx %d.\n", minx, maxx);
 
   while ((x <= (u16)dx)  &&  (x <= (u16)maxx)) {
@@ -298,7 +434,6 @@ void PlotPartLine(u16 x0, u16 y0,  s16 dx, s16 dy, s16 minx, s16 miny, s16 maxx,
       xp = (sx < 0) ? x0-xp : x0+xp;
       yp = (sy < 0) ? y0-yp : y0+yp;
 
-      int alpha = (FULL*D)/dx;
       if (xi == 0) {
         if (yi < 0) PaintPair(VERT, xp, yp-1, alpha);
         else        PaintPair(VERT, xp, yp,   FULL-alpha);
@@ -308,17 +443,23 @@ void PlotPartLine(u16 x0, u16 y0,  s16 dx, s16 dy, s16 minx, s16 miny, s16 maxx,
       }
     }
 
-    D += dy;
+    D += dy;  alpha += step;  rest += stepr;
+    if (rest >= (u16)dx) {alpha++;  rest -= dx;}
 
     if (D >= (u16)dx) {
       y++;
       D -= dx;
+      alpha -= FULL;
     }
 
     x++;
   }
+
+  FlushPairs();
 }
 
+#endif
+
 
 
 const u8 PROGMEM sines[70] = { // Provides sines at steps of 1.25 degrees.
@@ -348,46 +489,173 @@ void GetVec(u16 step, s16 *dx, s16 *dy) { // step in 0..256, 1.25 degrees per st
 }
 
 
-void Reticulate(u16 x, u16 y) {
-  s16 dx, dy;
-  int step;
-  for(step=0; step<=256; step+=8) {
-    GetVec(step, &dx, &dy);
-    printf("  step %3d, dx %3d, dy %3d.\n", step, dx, dy);
-
-    //PlotLine(160, 320, dx/4, dy/4);
-
-    //PlotPartLine(
-    //  x,           y,            // Origin
-    //  dx,          dy,           // Slope
-    //  (dx*10)/256, (dy*10)/256,  // Start about 10 pixels from origin
-    //  (dx*37)/256, (dy*37)/256   // End about 37 pixels from origin
-    //);
-
-    if (step%16 == 0) {
-      PlotPartLine(
-        x,           y,            // Origin
-        dx,          dy,           // Slope
-        (dx*39)/256, (dy*39)/256,  // Start about 10 pixels from origin
-        (dx*53)/256, (dy*53)/256   // End about 37 pixels from origin
-      );
+// PlotRing draws an anti-aliased annulus a row at a time, top to bottom,
+// writing each row once as one region, or as two where it crosses the hole.
+// Coverage is taken from q = 4(x*x + y*y), four times the squared distance
+// of a pixel from the centre. With A = 2(r+t)+1 and B = 2(r-t)-1, outer
+// coverage falls from full to none as q rises from A*A-4A to A*A, and inner
+// coverage rises as q goes from B*B to B*B+4B. r+t must be below 127.
+//
+// Scale ticks are folded into the same pass. They are the lines that
+// PlotPartLine would draw from the centre: a pixel either side of the ideal
+// line across its minor axis, with alpha falling off with distance from it,
+// in foreground over background. The ticks are streamed rather than all
+// held: the scale runs down from its top to either end, so the ticks of
+// each arm are met in order by the rows, and each is worked out as the rows
+// reach it and dropped once they pass it. Only the few crossing the row and
+// the next of each arm are kept.
+//
+// Nothing is divided per row or pixel: the ring's edge widths and each
+// tick's major are turned into reciprocals once, and the columns a tick
+// touches on a row come from its slope in 8.8 fixed point, rounded so that
+// the span is a column wider rather than narrower.
+
+// Coverage(n, Reciprocal(d)) is FULL*n/d, or one more, for n < d <= 1020.
+u16 Reciprocal(u16 d)            {return (FULL*1024U + d-1) / d;}
+u8  Coverage(u16 n, u16 reciprocal) {return (n * reciprocal) >> 10;}
+
+#define TICKSWAP 1      // Y major
+#define TICKNEGX 2      // Line runs left
+#define TICKNEGY 4      // Line runs up
+
+struct tick {
+  u8  flags;
+  u16 major, minor;     // |dx| and |dy|, exchanged when y major
+  u16 run;              // Columns per row, 8.8, rounded down
+  u16 reciprocal;       // Reciprocal(major)
+  u8  first, last;      // Major offsets drawn
+  s8  top, bottom;      // Rows touched, relative to the centre
+};
+
+#define TICKSPANS 8     // Ticks crossing any one row
+#define TICKSTEP  8     // Steps between ticks, from 0 to 256
+#define TICKTOP   128   // Step of the tick at the top of the scale
+
+struct tickspan {
+  s8           first, last;  // Columns touched, relative to the centre
+  struct tick *tick;
+};
+
+u8 TickAlpha(struct tick *k, s16 x, s16 y) { // x, y relative to the centre
+  if (k->flags & TICKNEGX) x = -x;
+  if (k->flags & TICKNEGY) y = -y;
+  if (k->flags & TICKSWAP) {s16 s = x; x = y; y = s;}
+  if (x < k->first  ||  x > k->last  ||  y < 0) return 0;
+  s16 e = y*k->major - x*k->minor;  if (e < 0) e = -e;
+  if (e >= (s16)k->major) return 0;
+  return FULL - Coverage(e, k->reciprocal);
+}
+
+void Tick(struct tick *k, u16 step) { // The scale tick at step, a multiple of TICKSTEP
+  s16 dx, dy, lo, hi;
+  GetVec(step, &dx, &dy);
+  k->flags = 0;
+  if (dx < 0)  {dx = -dx;  k->flags |= TICKNEGX;}
+  if (dy < 0)  {dy = -dy;  k->flags |= TICKNEGY;}
+  if (dx < dy) {s16 s = dx; dx = dy; dy = s;  k->flags |= TICKSWAP;}
+  k->major = dx;  k->minor = dy;
+  u32 run = k->flags & TICKSWAP ? ((u32)dy << 8) / dx : dy ? ((u32)dx << 8) / dy : 0;
+  k->run = run > 0xFFFF ? 0xFFFF : run;
+  k->reciprocal = Reciprocal(dx);
+  k->first = (dx * (step%16 ? 42 : 39)) / 256 + 1;  // Long ticks every 20 degrees
+  k->last  = (dx * (step%16 ? 51 : 53)) / 256;
+  if (k->flags & TICKSWAP) {lo = k->first;  hi = k->last;}
+  else                     {lo = (k->first * dy) / dx;  hi = (k->last * dy) / dx + 1;}
+  if (k->flags & TICKNEGY) {k->top = -hi;  k->bottom = -lo;}
+  else                     {k->top =  lo;  k->bottom =  hi;}
+}
+
+void PlotRing(u16 cx, u16 cy, u16 r, u16 t, u8 scaled) { // With the scale's ticks if scaled
+  u16 A = 2*(r+t) + 1,          A2 = A*A,  A4 = 4*A;
+  u16 B = r > t ? 2*(r-t)-1 : 0, B2 = B*B,  B4 = 4*B;
+  u16 RA = Reciprocal(A4),  RB = B ? Reciprocal(B4) : 0;
+  s16 xo = -1;          // Last column touched
+  s16 xh = -1;          // Last column of the hole
+  struct tick ticks[TICKSPANS];  // Ticks the rows have reached and not passed
+  struct tick next[2];           // Next tick of each arm
+  s16 arm[2] = {TICKTOP, TICKTOP+TICKSTEP};  // Its step: the left arm runs down to 0, the right up to 256
+  u8  nticks = 0;
+  struct tickspan spans[TICKSPANS];
+  s16 run[4];
+  s16 y, x, last;
+  u8  i, n;
+  u16 probe = ProbeStart();
+
+  if (scaled) {Tick(&next[0], arm[0]);  Tick(&next[1], arm[1]);}
+
+  for (y = -(s16)(r+t); y <= (s16)(r+t); y++) {
+    u16 ay = y < 0 ? -y : y,  y2 = 4*ay*ay;
+    while (4*(u16)((xo+1)*(xo+1)) + y2 <  A2) xo++;
+    while (4*(u16)(xo*xo) + y2 >= A2) xo--;
+    if (B) {
+      while (4*(u16)((xh+1)*(xh+1)) + y2 <= B2) xh++;
+      while (xh >= 0  &&  4*(u16)(xh*xh) + y2 > B2) xh--;
+    }
+
+    if (scaled) {
+      for (i = 0; i < nticks; ) if (ticks[i].bottom < y) ticks[i] = ticks[--nticks]; else i++;
+      for (i = 0; i < 2; i++) {
+        while (arm[i] >= 0  &&  arm[i] <= 256  &&  next[i].top <= y  &&  nticks < TICKSPANS) {
+          ticks[nticks++] = next[i];
+          arm[i] += i ? TICKSTEP : -TICKSTEP;
+          if (arm[i] >= 0  &&  arm[i] <= 256) Tick(&next[i], arm[i]);
+        }
+      }
     }
 
-    PlotPartLine(
-      x,           y,            // Origin
-      dx,          dy,           // Slope
-      (dx*42)/256, (dy*42)/256,  // Start about 10 pixels from origin
-      (dx*51)/256, (dy*51)/256  // Start about 10 pixels from origin
-      //(dx*53)/256, (dy*53)/256   // End about 37 pixels from origin
-    );
+    // Columns of this row that each tick may touch
+    n = 0;
+    for (struct tick *k = ticks; k < ticks+nticks; k++) {
+      if (y < k->top  ||  y > k->bottom) continue;
+      s16 m = k->flags & TICKNEGY ? -y : y;
+      if (k->flags & TICKSWAP) {
+        x = (m * k->run) >> 8;  last = x+2;
+      } else {
+        x = k->first;  last = k->last;
+        if (k->minor) {
+          s16 lo = m ? ((u32)(m-1) * k->run) >> 8 : 0,  hi = (((u32)(m+1) * k->run) >> 8) + 2;
+          if (lo > x)    x    = lo;
+          if (hi < last) last = hi;
+        }
+      }
+      if (k->flags & TICKNEGX) {s16 s = -x; x = -last; last = s;}
+      spans[n].first = x;  spans[n].last = last;  spans[n].tick = k;  n++;
+    }
+
+    run[0] = -xo;  run[1] = xo;
+    if (xh >= 0) {run[1] = -xh-1;  run[2] = xh+1;  run[3] = xo;}
+
+    for (i = 0; i < (xh >= 0 ? 4 : 2); i += 2) {
+      x = run[i];  last = run[i+1];
+      u16 q = 4*(u16)(x*x) + y2;
+      u16 rgb = 0;  u8 len = 0;  // Run of equal pixels not yet sent
+      WriteRegion(cx+x, cy+y, cx+last, cy+y);
+      for (; x <= last; x++) {
+        u8 alpha = FULL, tick = 0, j;
+        if (q > A2 - A4)      alpha = Coverage(A2 - q, RA);
+        if (B  &&  q < B2+B4) {u8 inner = Coverage(q - B2, RB);  if (inner < alpha) alpha = inner;}
+        for (j = 0; j < n; j++) if (x >= spans[j].first  &&  x <= spans[j].last) {
+          u8 a = TickAlpha(spans[j].tick, x, y);  if (a > tick) tick = a;
+        }
+        u16 pixel = tick ? Ramp(foreground, background, tick) : Ramp(paint, BLACK, alpha);
+        if (len  &&  pixel != rgb) {RepeatDataWord(rgb, len);  len = 0;}
+        rgb = pixel;  len++;
+        q += 8*x + 4;
+      }
+      RepeatDataWord(rgb, len);
+      ReleaseLcd();
+    }
   }
+  ProbeEnd(PROBERING, probe);
 }
 
+void PlotHollowCircle(u16 cx, u16 cy, u16 r, u16 t) {PlotRing(cx, cy, r, t, 0);}
 
-void DrawPointer(u16 x, u16 y, u16 step, u16 colour) {
+#if PLOTLINE
+
+void PlotPointer(u16 x, u16 y, u16 step) { // In current foreground and background
   s16 dx, dy;
   GetVec(step, &dx, &dy);
-  background = BLACK; foreground = colour;
   PlotPartLine(
     x, y,
     dx, dy,
@@ -396,95 +664,15 @@ void DrawPointer(u16 x, u16 y, u16 step, u16 colour) {
   );
 }
 
-
-void scale(u16 x, u16 y, u16 p) {
-  paint = p;  background = p;  foreground = WHITE;
-  PlotHollowCircle(x, y, 46, 8);
-  Reticulate(x, y);
-}
-
-
-struct knob {
-  u16 x, y;
-  u16 curstep, nextstep;
-  u8 reading;
-} knobs[4];
-
-struct knob *rknob  = &knobs[0];
-struct knob *gknob  = &knobs[1];
-struct knob *bknob  = &knobs[2];
-struct knob *wwknob = &knobs[3];
-
-u8 currknob = 3;
-u8 knobdown = 0;
-
-void UpdatePointer(struct knob *k) {
-  DrawPointer(k->x, k->y, k->curstep, BLACK);
-  k->curstep = k->nextstep;
-  DrawPointer(k->x, k->y, k->curstep, WHITE);
-}
-
-void InitKnob(u16 x, u16 y, u16 colour, struct knob *k) {
-  k->x        = x;
-  k->y        = y;
-  k->curstep  = 128;
-  k->nextstep = 128;
-  k->reading  = 0;
-  scale(x, y, colour);
-  DrawPointer(k->x, k->y, k->curstep, WHITE);
-}
-
-void TurnKnob(struct knob *k, u8 backward) {
-  if (backward) {if (k->nextstep >   0) k->nextstep--;}
-  else          {if (k->nextstep < 255) k->nextstep++;}
-}
-
-
-//----------------------------------------------------------------------------//
-
-void Initscreen() {
-  printf("Clear to black.\n");
-  FillColour(0,0, 320,480, 0);       // Clear screen to black
-
-  printf("RenderAlphaMap letter a.\n");
-  RenderAlphaMap(10,10, am1);
-
-  printf("Plot the colour knob scales.\n");
-  InitKnob(260, 60, 0xFA20, rknob);
-  InitKnob(260,180, 0x8400, gknob);
-  InitKnob(260,300, 0x49F1, bknob);
-  InitKnob(260,420, 0xCDCA, wwknob);
-
-  for (int i=0; i<4; i++) {
-    knobs[i].nextstep=0; UpdatePointer(&knobs[i]);
-  }
+void DrawPointer(u16 x, u16 y, u16 step, u16 colour) {
+  background = BLACK; foreground = colour;
+  PlotPointer(x, y, step);
 }
 
-u8 turning = 0;
+#endif
 
-void PinChangeInterrupt() {
-  u8 port = PINB;
 
-  u8 phase = port & 3;
-  if (phase == 0) turning = 1;
-  else if (turning) {
-    if (phase == 3) {
-      TurnKnob(&knobs[currknob], turning&1); turning = 0;
-    }
-    else turning = phase;
-  }
-
-  u8 pressed = (port & 0x80) == 0;
-  if (pressed) { // Knob is pressed
-    if (knobdown == 0) currknob = (currknob+1) % 4; // Advance colour at first suggestion of press
-    knobdown = 1;
-    TIFR0    = 7;  // Clear any pending timer 0 interrupts
-    TCNT0    = 0;  // Reset timer 0 to count = 0
-    TIMSK0   = 1;  // Enable interrupt on timer 0 overflow
-  }
-}
-
-void Timer0Interrupt() { // knob has been released for 32ms
-  knobdown = 0;
-  TIMSK0 = 0;  // Leave timer 0 running but disable its interrupts
+void scale(u16 x, u16 y, u16 p) {
+  paint = p;  background = p;  foreground = WHITE;
+  PlotRing(x, y, 46, 8, 1);
 }
@@ -9,6 +9,13 @@
 // Note, the wireless SPI implementation shares port B with the knob,
 // which uses PB0 and PB1 as inputs.
 
+// The nRF24L01+'s IRQ is not connected: completion is seen by polling
+// STATUS (see RfPoll below).
+//
+// Until InitWireless completes, transfers are made by polling SPIF through
+// spi(). After that the SPI transfer complete interrupt clocks out queued
+// transactions (see below) and spi() is only used from SpiInterrupt.
+
 u8 spi(u8 cmd) {SPDR = cmd; while (!(SPSR & (1<<SPIF))); return SPDR;}
 
 #define CSN0 PORTB &= ~0x04;  // Bring nRF24L01+ slave select low (active)
@@ -22,11 +29,13 @@ u8 spi(u8 cmd) {SPDR = cmd; while (!(SPSR & (1<<SPIF))); return SPDR;}
 #define RF_CH        0x05
 #define RF_SETUP     0x06
 #define STATUS       0x07
+#define OBSERVE_TX   0x08
 #define RX_ADDR_P0   0x0A
 #define RX_ADDR_P1   0x0B
 #define TX_ADDR      0x10
 #define RX_PW_P0     0x11
 #define RX_PW_P1     0x12
+#define FIFO_STATUS  0x17
 #define FEATURE      0x1D
 #define DYNPD        0x1C
 
@@ -35,61 +44,393 @@ u8 spi(u8 cmd) {SPDR = cmd; while (!(SPSR & (1<<SPIF))); return SPDR;}
 //#define ACTIVATE   0x50
 #define FLUSH_TX     0xE1
 #define FLUSH_RX     0xE2
+#define R_RX_PAYLOAD 0x61
 #define W_TX_PAYLOAD 0xA0
+#define W_TX_PAYLOAD_NOACK 0xB0
+#define NOP          0xFF
+
+// Register shadow
+//
+// rfreg holds the value last written to each single byte register, and
+// rfaddr the address last written to TX_ADDR and RX_ADDR_P0, which are
+// always set together. Writes made by the interrupt driven scripts are
+// dropped when the register already holds the value. The blocking writes
+// used by InitWireless always go to the device, establishing the shadow.
+
+u8  rfreg[0x1E];
+u8  rfaddr[5];
+u16 rfclocked;   // SPI bytes clocked out by scripts
+u16 rfsaved;     // SPI bytes not clocked out because the shadow matched
 
 void WriteRfCmd(u8 cmd)         {CSN0; spi(cmd); CSN1;}
-void WriteRfReg(u8 reg, u8 val) {CSN0; spi(W_REGISTER|reg); spi(val); CSN1;}
+void WriteRfReg(u8 reg, u8 val) {CSN0; spi(W_REGISTER|reg); spi(val); CSN1; rfreg[reg] = val;}
 void WriteRfAdr(u8 reg, u8 *adr) {
   CSN0; spi(W_REGISTER|reg); for (int i=0; i<5; i++) spi(adr[i]); CSN1;
+  if (reg == TX_ADDR) for (int i=0; i<5; i++) rfaddr[i] = adr[i];
 }
 
 void ReadRfReg(u8 reg) {CSN0; spi(reg); spi(0xFF); CSN1;}
 
-void InitWireless() {
-  DDRB  = 0x2C;  // nSS, SCK and MOSI are outputs
-  PORTB = 0xC7;  // Lower SCK and MOSI, nSS remains high
-  SPCR  = (1<<SPE)|(1<<MSTR)|(1<<SPR0);
-  CSN1; delay(100);
-  WriteRfCmd(FLUSH_TX);
-  WriteRfReg(CONFIG,     0x0E);     // Power up in TX mode with 2 byte CRCs
-  delay(5);
-  WriteRfReg(EN_AA,      0x00);     // Disable auto acknowledgement on all data pipes
-//WriteRfReg(SETUP_RETR, 0x34);     // 1ms per retry, 4 retries
-  WriteRfReg(RF_SETUP,   0x04);     // 1Mbps data rate, -6dBm power
-  WriteRfReg(FEATURE,    0x00);     // Disable EN_DPL, EN_ACK_PAY and EN_DYN_ACK
-  WriteRfReg(DYNPD,      0x00);     // Disable dynamic payload on all pipes
-  WriteRfReg(STATUS,     0x70);     // Clear all three interrupt flags
-  WriteRfReg(RF_CH,        76);     // This channel should be universally safe and not bleed over into adjacent spectrum.
-  WriteRfCmd(FLUSH_TX);
-  WriteRfCmd(FLUSH_RX);
-  WriteRfReg(CONFIG,     0x0E);     // Power up in TX mode with 2 byte CRCs
-  delay(5);
-
-//WriteRfReg(EN_AA, 0x03);     // Enable auto acknowledge on pipes 0 and 1
-
-//WriteRfReg(EN_RXADDR, 3);    // Enable Rx on pipes 0 (for tx ack) and 1
-}
+// Messages
+//
+// Strips are addressed as "x5925" where x is '1'..'4' for a single strip,
+// or BROADCAST for all of them. Every message is a PAYLOAD byte packet whose
+// first byte gives the message type:
+//
+//   MSGCOLOURS  [1]       dirty mask, bit n set if strip n is to change
+//               [2+4n..]  red, green, blue and warm white for strip n
+//               [20+2n]   red (high nibble) and green sixteenths for strip n
+//               [21+2n]   blue (high nibble) and warm white sixteenths
+//
+//   MSGSEGMENT  [1]       strip mask, bit n set if for strip n
+//               [2]       segment slot (0-7)
+//               [3]       first pixel
+//               [4]       number of pixels, 0 to remove the segment
+//               [5..8]    red, green, blue and warm white at the first pixel
+//               [9..12]   red, green, blue and warm white at the last pixel
+//
+//   MSGFADE     [1]       dirty mask, bit n set if strip n is to change
+//               [2+4n..]  red, green, blue and warm white for strip n
+//               [18..19]  frames (20ms) to reach it, 0 for at once
+//               [20+2n..] sixteenths for strip n, as MSGCOLOURS
+//
+//   MSGSTORE    [1]       strip mask, bit n set if strip n is to store
+//               [2+4n..]  red, green, blue and warm white for strip n
+//               [18]      scene (0-15) to store them as
+//               [20+2n..] sixteenths for strip n, as MSGCOLOURS
+//
+//   MSGRECALL   [1]       strip mask, bit n set if strip n is to recall
+//               [2]       scene (0-15)
+//               [3..4]    frames (20ms) to fade to it, 0 for at once
+//
+// Messages to a single strip also carry a sequence number in [SEQUENCE],
+// and are acknowledged (see Links below). Broadcasts are not: all the
+// strips answering at once would collide.
+//
+// A single colour or fade message updates any number of strips at once. A
+// segment overrides the strip's colour with a plain or graded zone, see
+// ledstrip.s. Unused bytes are zero, so levels are whole unless sixteenths
+// are given. The strips dither fractional levels, including those passed
+// through during a fade. Each strip keeps its own colour for each scene in
+// eeprom, so a recall is the same few bytes however many strips it moves
+// (see scenes.h).
+
+#define PAYLOAD    32
+#define SEQUENCE   31
+#define BROADCAST  '0'
+#define STRIP(i)   ('1' + (i))
+#define MSGCOLOURS 0x01
+#define MSGSEGMENT 0x02
+#define MSGFADE    0x03
+#define MSGSTORE   0x04
+#define MSGRECALL  0x05
 
 u8 writeAddr[5] = {"x5925"};
 
+// Initialisation is a sequence of INITWIRELESSSTEPS steps, each returning
+// the ms to wait before the next, so that the nRF24L01+'s power on reset and
+// power up waits can overlap other work (see BootTask in controller.c).
+// The SPI is handed over to SpiInterrupt by the last step.
+
+#define INITWIRELESSSTEPS 4
+
+u8 InitWirelessStep(u8 step) {
+  switch (step) {
+    case 0:
+      DDRB  = 0x2C;  // nSS, SCK and MOSI are outputs
+      PORTB = 0xC7;  // Lower SCK and MOSI, nSS remains high, pull ups on knob and unused inputs
+      SPCR  = (1<<SPE)|(1<<MSTR);  // Master, fosc/4 ...
+      SPSR  = (1<<SPI2X);          // ... doubled to fosc/2 = 4MHz, the fastest available (nRF24L01+ max 10MHz)
+      CSN1;
+      return 100;                  // Power on reset
+
+    case 1:
+      WriteRfCmd(FLUSH_TX);
+      WriteRfReg(CONFIG,     0x0E);     // Power up in TX mode with 2 byte CRCs
+      return 5;
+
+    case 2:
+      WriteRfReg(EN_AA,      0x01);     // Auto acknowledgement, received on pipe 0
+      WriteRfReg(SETUP_RETR, 0x15);     // 500us per retry, enough for any ACK payload at 1Mbps, 5 retries
+      WriteRfReg(RF_SETUP,   0x04);     // 1Mbps data rate, -6dBm power
+      WriteRfReg(FEATURE,    0x07);     // EN_DPL and EN_ACK_PAY for telemetry, EN_DYN_ACK for broadcasts
+      WriteRfReg(DYNPD,      0x01);     // Dynamic payload on pipe 0, needed for ACK payloads
+      WriteRfReg(STATUS,     0x70);     // Clear all three interrupt flags
+      WriteRfReg(RF_CH,        76);     // This channel should be universally safe and not bleed over into adjacent spectrum.
+      WriteRfCmd(FLUSH_TX);
+      WriteRfCmd(FLUSH_RX);
+      WriteRfReg(CONFIG,     0x0E);     // Power up in TX mode with 2 byte CRCs
+      return 5;
+  }
+
+  writeAddr[0] = BROADCAST;         // Where almost every packet goes
+  WriteRfAdr(RX_ADDR_P0, writeAddr);
+  WriteRfAdr(TX_ADDR,    writeAddr);
+  WriteRfReg(RX_PW_P0,   PAYLOAD);
+
+  SPCR |= (1<<SPIE);                // Hand the SPI over to SpiInterrupt
+  return 0;
+}
+
+void InitWireless() {for (u8 step=0; step<INITWIRELESSSTEPS; step++) delay(InitWirelessStep(step));}
+
+
 u8 RfStatus() {CSN0; u8 status = spi(0xFF); CSN1; return status;}
 
-void WriteTxPayload(u8 *buf, u8 len) {
-  CSN0; spi(W_TX_PAYLOAD); for (u8 i=0; i<len; i++) spi(buf[i]); CSN1;
+
+// Interrupt driven transmission
+//
+// SPI traffic is prepared as a script of CSN framed transactions, each a
+// length byte followed by the bytes to send. SpiInterrupt clocks the script
+// out a byte per SPI transfer complete interrupt, raising CSN between
+// transactions. The first byte of each transaction is started from the
+// interrupt, and the rest are clocked back to back by polling SPIF: at 4MHz
+// a byte takes 16 cycles, less than an interrupt entry and exit. The bytes
+// received replace those sent in the script, where ScriptDone can read
+// them. The first byte returned by each transaction is the STATUS register,
+// which is kept in rfstatus.
+//
+// Messages passed to RfWrite are queued and RfWrite returns at once. Each
+// packet is loaded by a script that sets the addresses and writes the
+// payload. CE is tied high, so the packet is sent as soon as it is in the
+// TX FIFO. A packet to a single strip asks for an acknowledgement, the
+// nRF24L01+ sending it again up to 5 times; a broadcast is written with
+// W_TX_PAYLOAD_NOACK. TX_DS or MAX_RT is then seen in STATUS, which every
+// transaction returns: RfPoll, called from the main loop while packets are
+// being sent, clocks out a NOP to read it. Either flag starts a script that
+// clears them, and when that completes the next queued packet is loaded. For an acknowledged packet
+// the script first reads OBSERVE_TX and any ACK payload, and flushes both
+// FIFOs, a packet that reached MAX_RT being left in the TX FIFO.
+//
+// Broadcasts are pipelined: while the TX FIFO holds only broadcasts, the
+// next queued broadcast is loaded behind them without waiting for TX_DS, up
+// to TXFIFO packets, so that they go out back to back. Their clearing
+// script reads FIFO_STATUS after clearing TX_DS, as several may have been
+// sent for one TX_DS. rfinfifo counts the packets loaded and not yet
+// seen sent: 0 when TX_EMPTY, TXFIFO when TX_FULL, and otherwise no more
+// than TXFIFO-1, so it may run one ahead of the FIFO until the next
+// TX_DS, but never behind. A packet to a single strip waits for the
+// TX FIFO to empty, as its clearing script flushes it.
+
+#define RFIDLE     0  // Nothing in progress
+#define RFLOADING  1  // Script loading a packet is being clocked out
+#define RFSENDING  2  // Packets in TX FIFO, waiting for TX_DS or MAX_RT
+#define RFCLEARING 3  // Script clearing STATUS is being clocked out
+#define RFPOLLING  4  // NOP reading STATUS is being clocked out
+
+#define TXQUEUE 4     // Packets that may be waiting to be loaded
+#define TXFIFO  3     // Packets the nRF24L01+'s TX FIFO holds
+
+struct packet {u8 address; u8 payload[PAYLOAD];};
+
+struct packet txqueue[TXQUEUE];
+volatile u8   txhead, txtail;   // Next entry to fill, next entry to load
+volatile u8   rfstate = RFIDLE;
+volatile u8   rfstatus;         // STATUS as returned by the most recent transaction
+volatile u16  rfsent, rflost;   // Packets completed with TX_DS, with MAX_RT
+volatile u8   rfinfifo;         // Packets loaded and not yet seen sent, at least those in the TX FIFO
+
+u16         rfloadat;           // Probe time at which the first packet was loaded into the empty TX FIFO
+u8          rfto;               // Strip the packets in the TX FIFO are for, 0xFF for broadcasts
+u8          rffifo;             // Where a broadcast's clearing script reads FIFO_STATUS
+
+u8          spiscript[56];
+u8          spilen;             // Bytes in script
+volatile u8 spipos;             // Next script byte to send
+volatile u8 spiframe;           // Bytes of current transaction still to complete
+volatile u8 spifirst;           // Next byte received is STATUS
+
+u8 TxQueued() {return (u8)(txhead - txtail);}
+
+void SpiFrame() {
+  spiframe = spiscript[spipos++];
+  spifirst = 1;
+  CSN0;
+  SPDR = spiscript[spipos++];
+}
+
+void SpiStart() {spipos = 0; SpiFrame();}
+
+void ScriptAdd(u8 len, u8 cmd, const u8 *data) {
+  rfclocked += len+1;
+  spiscript[spilen++] = len+1;
+  spiscript[spilen++] = cmd;
+  while (len--) spiscript[spilen++] = *(data++);
+}
+
+u8 ScriptRead(u8 len, u8 cmd) { // Returns where the len bytes read will be
+  rfclocked += len+1;
+  spiscript[spilen++] = len+1;
+  spiscript[spilen++] = cmd;
+  u8 at = spilen;
+  while (len--) spiscript[spilen++] = 0xFF;
+  return at;
+}
+
+void ScriptReg(u8 reg, u8 val) {
+  if (rfreg[reg] == val) {rfsaved += 2; return;}
+  rfreg[reg] = val;
+  ScriptAdd(1, W_REGISTER|reg, &val);
+}
+
+void ScriptAddr(const u8 *adr) { // Set TX_ADDR and RX_ADDR_P0
+  u8 i = 0;
+  while (i < 5  &&  rfaddr[i] == adr[i]) i++;
+  if (i == 5) {rfsaved += 12; return;}
+  for (i=0; i<5; i++) rfaddr[i] = adr[i];
+  ScriptAdd(5, W_REGISTER|RX_ADDR_P0, rfaddr);
+  ScriptAdd(5, W_REGISTER|TX_ADDR,    rfaddr);
+}
+
+// Links
+//
+// Each strip's link is followed through its acknowledged packets: the
+// transmissions made, counting the nRF24L01+'s retries from OBSERVE_TX, the
+// packets acknowledged, those that reached MAX_RT, and the telemetry the
+// strip returned with its last acknowledgement (see ledstrip.s). That
+// describes the packet before, the strip loading it into the nRF24L01+ once
+// a packet is applied. A strip whose last packet failed stays marked in
+// RfFailed until a packet to it is acknowledged.
+
+#define TELEMETRY 3   // Sequence number, refresh time in 128us counts, RX FIFO overflows
+
+struct link {
+  u8  sequence;                 // Of the last packet sent
+  u16 attempts, acked, failed;
+  u8  telemetry[TELEMETRY];
+};
+
+volatile struct link links[4];
+volatile u8 rffailed;           // Bit n set if strip n's last packet reached MAX_RT
+u8          rfobserved, rfack;  // Where the clearing script reads OBSERVE_TX and the ACK payload
+
+void LinkDone(volatile struct link *l, u8 bit) { // Account for the packet just sent to a strip
+  l->attempts += 1 + (spiscript[rfobserved] & 0x0F);  // ARC_CNT: retries
+  if (rfstatus & 0x10) {l->failed++;  rffailed |= bit;  return;}
+  l->acked++;
+  rffailed &= ~bit;
+  if (rfstatus & 0x40) for (u8 i=0; i<TELEMETRY; i++) l->telemetry[i] = spiscript[rfack+i];
 }
 
-void RfWrite(u8 strip, u8 *payload) { // Payload length hardcoded at 4 bytes
+u8 RfFailed() { // Strips whose last packet failed
+  return rffailed;
+}
+
+u8 RfLoadable() { // With interrupts disabled, whether the next queued packet may be loaded now
+  if (!TxQueued()) return 0;
+  if (!rfinfifo)   return 1;
+  return rfto == 0xFF  &&  rfinfifo < TXFIFO  &&  txqueue[txtail % TXQUEUE].address == BROADCAST;
+}
+
+void RfNext() { // With interrupts disabled and no script running, load the next queued packet if able
+  if (!RfLoadable()) {rfstate = rfinfifo ? RFSENDING : RFIDLE; return;}
+  struct packet *p = &txqueue[txtail % TXQUEUE];
   // Transmit to "x5925", receiving acknowledgements on P0
-  writeAddr[0] = strip+'1';
-  WriteRfAdr(RX_ADDR_P0, writeAddr);
-  WriteRfAdr(TX_ADDR,    writeAddr);
-  WriteRfReg(RX_PW_P0, 4);     // Payload length
-  WriteTxPayload(payload, 4);
+  writeAddr[0] = p->address;
+  rfto = p->address - STRIP(0);
+  spilen = 0;
+  ScriptAddr(writeAddr);
+  ScriptReg(RX_PW_P0, PAYLOAD);
+  if (rfto < 4) {
+    p->payload[SEQUENCE] = ++links[rfto].sequence;
+    ScriptAdd(PAYLOAD, W_TX_PAYLOAD, p->payload);
+  } else {
+    rfto = 0xFF;
+    ScriptAdd(PAYLOAD, W_TX_PAYLOAD_NOACK, p->payload);
+  }
+  txtail++;
+  if (!rfinfifo) rfloadat = ProbeStart();
+  rfinfifo++;
+  rfstate = RFLOADING;
+  SpiStart();
+}
+
+void RfClear() { // With TX_DS or MAX_RT set and no script running, clear the interrupt flags
+  spilen = 0;
+  if (rfto < 4) {
+    rfobserved = ScriptRead(1, OBSERVE_TX);
+    rfack      = ScriptRead(TELEMETRY, R_RX_PAYLOAD);  // Only meaningful with RX_DR
+    ScriptAdd(0, FLUSH_RX, 0);
+    ScriptAdd(0, FLUSH_TX, 0);
+    ScriptAdd(1, W_REGISTER|STATUS, (u8[]){0x70});     // Clear all three interrupt flags
+  } else {
+    ScriptAdd(1, W_REGISTER|STATUS, (u8[]){0x70});
+    rffifo = ScriptRead(1, FIFO_STATUS);                // Broadcasts sent before the flags were cleared
+  }
+  rfstate = RFCLEARING;
+  SpiStart();
+}
+
+void ScriptDone() {
+  if (rfstate == RFCLEARING) {
+    if (rfto < 4) {
+      if (rfstatus & 0x10) rflost++;  // MAX_RT
+      else                 rfsent++;
+      LinkDone(&links[rfto], 1<<rfto);
+      rfinfifo = 0;
+    } else {
+      u8 fifo = spiscript[rffifo], left;
+      if      (fifo & 0x10) left = 0;       // TX_EMPTY
+      else if (fifo & 0x20) left = TXFIFO;  // TX_FULL
+      else                  left = rfinfifo < TXFIFO-1 ? rfinfifo : TXFIFO-1;
+      rfsent  += rfinfifo - left;
+      rfinfifo = left;
+    }
+    if (!rfinfifo) ProbeEnd(PROBESEND, rfloadat);
+  }
+  // The script's last STATUS, read after any clearing, may show a packet sent
+  if (rfinfifo  &&  (rfstatus & 0x30)) RfClear();
+  else RfNext();
+}
+
+void SpiInterrupt() {
+  u16 probe = ProbeStart();
+  u8 in = SPDR;
+  if (spifirst) {rfstatus = in; spifirst = 0;}
+  while (--spiframe) {spiscript[spipos] = spi(spiscript[spipos]);  spipos++;}
+  CSN1;
+  if (spipos < spilen) SpiFrame(); else ScriptDone();
+  ProbeEnd(PROBESPI, probe);
+}
+
+void RfPoll() { // Read STATUS if packets are being sent
+  u8 sreg = SREG;  cli();
+  if (rfstate == RFSENDING) {
+    spilen = 0;
+    ScriptAdd(0, NOP, 0);
+    rfstate = RFPOLLING;
+    SpiStart();
+  }
+  SREG = sreg;
 }
 
+u8 RfIdle() {return rfstate == RFIDLE  &&  !TxQueued();}
 
-void sendLed(u8 r, u8 g, u8 b, u8 ww) {
-  u8 payload[4]; payload[0] = r; payload[1] = g; payload[2] = b; payload[3] = ww;
-  RfWrite(0, payload);
+u8 RfWrite(u8 address, u8 *payload) { // PAYLOAD bytes to "x5925". Returns 0 if queue full.
+  u8 sreg = SREG;  cli();
+  u8 queued = TxQueued() < TXQUEUE;
+  if (queued) {
+    struct packet *p = &txqueue[txhead % TXQUEUE];
+    p->address = address;
+    for (u8 i=0; i<PAYLOAD; i++) p->payload[i] = payload[i];
+    txhead++;
+    if (rfstate == RFIDLE  ||  rfstate == RFSENDING) RfNext();
+  }
+  SREG = sreg;
+  return queued;
 }
 
+
+void sendLed(u8 r, u8 g, u8 b, u8 ww) { // Set all strips to the same colour
+  u8 payload[PAYLOAD] = {MSGCOLOURS, 0x0F};
+  for (u8 i=0; i<4; i++) {
+    payload[2+4*i] = r; payload[3+4*i] = g; payload[4+4*i] = b; payload[5+4*i] = ww;
+  }
+  RfWrite(BROADCAST, payload);
+}
+
+u8 SendSegment(u8 strips, u8 slot, u8 start, u8 length, u8 *first, u8 *last) {
+  u8 payload[PAYLOAD] = {MSGSEGMENT, strips, slot, start, length};
+  for (u8 i=0; i<4; i++) {payload[5+i] = first[i]; payload[9+i] = last[i];}
+  return RfWrite(BROADCAST, payload);
+}
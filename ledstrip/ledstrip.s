@@ -46,6 +46,7 @@
           .equ   TCNT0, 0x32 ; Timer/counter 0 current count
           .equ   TCCR0B,0x33 ; Timer/counter control register B
           .equ   MCUCR, 0x35 ; MCU control register
+          .equ   TIFR,  0x38 ; Timer/counter interrupt flag register
           .equ   TIMSK, 0x39 ; Timer/counter interrupt mask register
           .equ   GIFR,  0x3A ; General interrupt flag register
           .equ   GIMSK, 0x3B ; General interrupt mask register
@@ -55,12 +56,231 @@
 
           .equ   CSN,3       ; PORTB bit connected to nRF24L01+ SPI chip select not
           .equ   LDO,4       ; PORTB bit used for output to LED strip
+          .equ   OCF0A,4     ; TIFR bit set each fade frame
+
+
+
+
+;         Messages
+;
+;         All strips listen on the shared address "05925", and each on its
+;         own address "n5925", where n is '1' to '4' for strip 0 to 3. Every
+;         message is a PAYLOAD byte packet whose first byte gives the message
+;         type:
+;
+;         MSGCOLOURS  [1]       dirty mask, bit n set if strip n is to change
+;                     [2+4n..]  red, green, blue and warm white for strip n
+;                     [20+2n]   red (high nibble) and green sixteenths for strip n
+;                     [21+2n]   blue (high nibble) and warm white sixteenths
+;
+;         MSGSEGMENT  [1]       strip mask, bit n set if for strip n
+;                     [2]       segment slot (0-7)
+;                     [3]       first pixel
+;                     [4]       number of pixels, 0 to remove the segment
+;                     [5..8]    red, green, blue and warm white at the first pixel
+;                     [9..12]   red, green, blue and warm white at the last pixel
+;
+;         MSGFADE     [1]       dirty mask, bit n set if strip n is to change
+;                     [2+4n..]  red, green, blue and warm white for strip n
+;                     [18..19]  frames (20ms) to reach it, 0 for at once
+;                     [20+2n..] sixteenths for strip n, as MSGCOLOURS
+;
+;         MSGSTORE    [1]       strip mask, bit n set if strip n is to store
+;                     [2+4n..]  red, green, blue and warm white for strip n
+;                     [18]      scene (0-15) to store them as
+;                     [20+2n..] sixteenths for strip n, as MSGCOLOURS
+;
+;         MSGRECALL   [1]       strip mask, bit n set if strip n is to recall
+;                     [2]       scene (0-15)
+;                     [3..4]    frames (20ms) to fade to it, 0 for at once
+;
+;         Our strip number n (0-3) is stored in eeprom location 1. Senders
+;         that zero unused bytes set whole levels only.
+;
+;         Messages to the shared address are not acknowledged: all the strips
+;         answering at once would collide. Those to our own address are
+;         acknowledged by the nRF24L01+, the sender retrying until one gets
+;         through, and carry a sequence number in [31]. Each acknowledgement
+;         returns the TELEMETRY held after the message before it:
+;
+;         0      sequence number of the last message to our own address
+;         1      time to refresh the strip, in 128us counts
+;         2      times the 3 message RX FIFO was found full, so that
+;                messages may have been lost (stops at 255)
+
+          .equ   PAYLOAD,32
+          .equ   SEQUENCE,31
+          .equ   MSGCOLOURS,1
+          .equ   MSGSEGMENT,2
+          .equ   MSGFADE,3
+          .equ   MSGSTORE,4
+          .equ   MSGRECALL,5
+
+
+
+
+;         SRAM usage
+;
+;         0x60-0x7F  free
+;         0x80-0x9F  received message
+;         0xA0-0x10F segment table
+;         0x110-0x121 fade
+;         0x122-0x125 fractions of the colour in r12..r15
+;         0x126      dither frame count
+;         0x127-0x130 scene being written to eeprom
+;         0x131-0x133 scene ring
+;         0x134-0x136 telemetry
+;         0x137      timer 0 count at the start of the refresh
+;         0x138      STATUS as the message in PACKET was read
+;         0x139-0x25F stack, down from RAMEND
+;
+;         No interrupts are enabled, so the stack only holds return
+;         addresses and saved registers. The deepest use is 8 bytes: the
+;         StoreScene and RecallScene EEFlush -> EEStep -> WriteEEProm ->
+;         ReadEEProm chain, and MSEC's pushes and msdelay in WirelessInit.
+
+          .equ   PACKET,0x80
+          .equ   SEGMENTS,0xA0
+          .equ   FADE,0x110
+          .equ   FINE,0x122
+          .equ   DITHER,0x126
+          .equ   STORE,0x127
+          .equ   RING,0x131
+          .equ   TELEMETRY,0x134
+          .equ   TELSEQUENCE,0
+          .equ   TELFRAME,1
+          .equ   TELOVERFLOW,2
+          .equ   TELSIZE,3
+          .equ   REFRESHAT,0x137
+          .equ   PACKETSTATUS,0x138
+          .equ   RAMEND,0x25F
+
+
+
+
+;         Segment table
+;
+;         The strip shows the colour in r12..r15 except where a segment
+;         overrides it. Each segment is a run of pixels fading linearly
+;         from one colour to another (or the same colour, for a plain zone).
+;         Segments are sent in slot order, and should be in ascending pixel
+;         order and not overlap: a segment starting before the end of an
+;         earlier one loses its overlapped pixels.
+;
+;         Entry layout:
+;
+;         0      first pixel
+;         1      number of pixels, 0 if the slot is unused
+;         2..5   red, green, blue and warm white at the first pixel
+;         6..13  red, green, blue and warm white 8.8 signed steps per pixel
+
+          .equ   SEGSTART,0
+          .equ   SEGLEN,1
+          .equ   SEGCOLOUR,2
+          .equ   SEGSTEP,6
+          .equ   SEGSIZE,14
+          .equ   NSEG,8
+
+
+
+
+;         Fade
+;
+;         A fade moves the colour in r12..r15 and its fractions at FINE to a
+;         target over a number of frames, stepping it in 8.8 fixed point once
+;         per Timer0 frame, then lands exactly on the target. A colour
+;         message cancels the fade. Segments do not fade.
+;
+;         Each channel's bytes are at the same offset in each group of four,
+;         so that one pointer indexes them all:
+;
+;         0..1   frames remaining, 0 if not fading
+;         2..5   red, green, blue and warm white target
+;         6..9   red, green, blue and warm white step per frame, fraction
+;         10..13 red, green, blue and warm white step per frame, signed whole
+;         14..17 red, green, blue and warm white target fractions
+
+          .equ   FADEFRAMES,0
+          .equ   FADETARGET,2
+          .equ   FADESTEP,6
+          .equ   FADEFINE,14
+
+
+
+
+;         Dithering
+;
+;         The strip is refreshed continuously, a frame every 7ms or so, with
+;         each channel rounded up or down according to its fraction: a
+;         channel at 20 and 5/16 shows 21 in 5 frames out of 16 and 20 in the
+;         rest. Each pixel compares its fractions with a threshold that steps
+;         by 0x9F (about 256/golden ratio) from pixel to pixel, and starts
+;         each frame at the bit reversed frame count. Neighbouring pixels
+;         therefore round up in different frames, keeping the strip's total
+;         brightness steady, and over any 256 frames each pixel shows its
+;         exact level.
+;
+;         Fractions come from the colour messages' sixteenths, from fades and
+;         from segment gradients.
+
+          .equ   DITHERSTEP,0x9F
+
+
+
+
+;         Scenes
+;
+;         The strip keeps SCENES colours in eeprom, stored by MSGSTORE and
+;         recalled by MSGRECALL, so a whole room changes scene on one short
+;         packet. The scene last stored or recalled is shown again from
+;         power up.
+;
+;         Eeprom layout:
+;
+;         1        strip number
+;         2..5     power up colour, until a scene is stored or recalled
+;         16..31   ring of scenes stored or recalled
+;         32+8s..  scene s: red, green, blue and warm white, then their
+;                  fractions as at FINE. Erased eeprom reads 0xFF, whose
+;                  low nibble marks a scene never stored.
+;
+;         Eeprom is written a byte per main loop pass, each write taking
+;         3.4ms while the strip refreshes, and only where the byte differs.
+;         STORE holds the scene being written:
+;
+;         0      scene, 0xFF if none
+;         1      next byte to write
+;         2..9   the scene's 8 bytes
+;
+;         Storing the scene already being written replaces the bytes not
+;         yet written, so a burst of stores costs one write of each byte
+;         that changed. Storing another scene, or recalling one, first
+;         finishes the writes.
+;
+;         Each scene stored or recalled is appended to the ring, so each of
+;         its bytes is written once per 16 scene changes. Bit 7 of an entry
+;         is the pass round the ring that wrote it, alternately 0 and 1:
+;         the last entry is the one before the first whose bit 7 differs
+;         from entry 0's, or entry 15 if none does. RING holds:
+;
+;         0      scene to append, 0xFF if none
+;         1      next entry
+;         2      bit 7 for this pass
+
+          .equ   SCENES,16
+          .equ   EERING,16
+          .equ   EESCENES,32
+          .equ   SCENESIZE,8
 
 
 
 
 ;         Global registers
 ;
+;         r0..r9, r26 and r27 are scratch for SetColour
+;
+;         r10 - Offset of our colour in MSGCOLOURS (2+4n)
+;         r11 - Our bit in the MSGCOLOURS dirty mask (1<<n)
 ;         r12 - Red
 ;         r13 - Green
 ;         r14 - Blue
@@ -176,44 +396,674 @@ seb6:     ret
 
 
 
-;;;       Set LED colour
+;;;       Run - send pixels, stepping the colour after each
+;;
+;;        Each channel is rounded up when the dither threshold is below its
+;;        fraction, short of 255.
+;;
+;;        entry  r28     - number of pixels
+;;               r1:r0   - red 8.8
+;;               r3:r2   - green 8.8
+;;               r5:r4   - blue 8.8
+;;               r7:r6   - warm white 8.8
+;;               r19:r18 - red step
+;;               r21:r20 - green step
+;;               r23:r22 - blue step
+;;               r25:r24 - warm white step
+;;               r9      - pixels sent so far
+;;               r26     - dither threshold
+;;               r27     - zero
+;;
+;;        exit   r9      - advanced past the run
+;;               r26     - stepped past the run
+
+Run:      add    r9,r28
+
+run2:     mov    r16,r3      ; Send green
+          cp     r26,r2      ; Carry if the threshold is below the fraction
+          adc    r16,r27     ; Round up
+          sbc    r16,r27     ; Back to 255 if that overflowed
+          rcall  LedByte
+
+          mov    r16,r1      ; Send red
+          cp     r26,r0
+          adc    r16,r27
+          sbc    r16,r27
+          rcall  LedByte
+
+          mov    r16,r5      ; Send blue
+          cp     r26,r4
+          adc    r16,r27
+          sbc    r16,r27
+          rcall  LedByte
+
+          mov    r16,r7      ; Send warm white
+          cp     r26,r6
+          adc    r16,r27
+          sbc    r16,r27
+          rcall  LedByte
+
+          subi   r26,lo8(-(DITHERSTEP)) ; Next pixel's threshold
+
+          add    r0,r18      ; Step to the next pixel's colour
+          adc    r1,r19
+          add    r2,r20
+          adc    r3,r21
+          add    r4,r22
+          adc    r5,r23
+          add    r6,r24
+          adc    r7,r25
+
+          dec    r28
+          brne   run2
+          ret
+
+
+;;        BaseRun - send r28 pixels of the colour in r12..r15 and FINE
+
+BaseRun:  mov    r1,r12
+          mov    r3,r13
+          mov    r5,r14
+          mov    r7,r15
+          lds    r0,FINE
+          lds    r2,FINE+1
+          lds    r4,FINE+2
+          lds    r6,FINE+3
+          clr    r18
+          clr    r19
+          movw   r20,r18
+          movw   r22,r18
+          movw   r24,r18
+          rjmp   Run
+
+
+
+
+
+
+;;;       Set LED colour - send one dithered frame
 ;;
 ;;        entry  r12 - Red
 ;;               r13 - Green
 ;;               r14 - Blue
 ;;               r15 - Warm white
+;;               FINE - their fractions
+;;
+;;        Sends r12..r15 to all 144 pixels except those covered by the
+;;        segment table. Colour changes between runs take up to 6us of
+;;        low time between pixels, well short of the 80us reset.
+;;
+;;        Called continuously by the main loop: a frame is 144 * 32 bits of
+;;        1.25us plus about 1.5us a byte between them, some 7ms.
 
 SetColour:
 
-;         Send reset
+;         Send reset, 100us low. The main loop's status poll adds a few
+;         us more.
 
           cbi    PORTB,LDO   ; B4 := 0
 
-          ldi    r31,16000>>8 ; Set countdown for 8 MSEC         ldi    r30,16000&0xFF
+          ldi    r30,lo8(200) ; Set countdown for 100us
+          ldi    r31,hi8(200)
 
-col2:     sbiw   30,1        ; (2)
+col2:     sbiw   r30,1       ; (2)
           brne   col2        ; (2)
 
-;         Send the RGBWW value all 144 pixels
+;         First pixel's dither threshold is the frame count bit reversed
+
+          lds    r16,DITHER
+          inc    r16
+          sts    DITHER,r16
+          ldi    r26,1       ; Marker bit, out to carry after 8 bits
+col3:     lsr    r16
+          rol    r26
+          brcc   col3
+          clr    r27
+
+;         Send each segment, preceded by the base colour up to its start
+
+          clr    r9          ; Pixels sent
+          ldi    r30,lo8(SEGMENTS)
+          ldi    r31,hi8(SEGMENTS)
+          ldi    r29,NSEG
+
+col4:     ldd    r17,Z+SEGLEN
+          tst    r17
+          breq   col8        ; Unused slot
+
+          ldd    r28,Z+SEGSTART
+          sub    r28,r9      ; Base colour pixels before the segment
+          breq   col6
+          brcs   col6        ; Overlaps an earlier segment
+          rcall  BaseRun
+
+col6:     ldd    r28,Z+SEGSTART
+          ldd    r17,Z+SEGLEN ; (LedByte used r17)
+          add    r28,r17
+          sub    r28,r9      ; Segment pixels not yet sent
+          breq   col8
+          brcs   col8        ; Entirely overlapped
+
+          ldd    r1,Z+SEGCOLOUR
+          ldd    r3,Z+SEGCOLOUR+1
+          ldd    r5,Z+SEGCOLOUR+2
+          ldd    r7,Z+SEGCOLOUR+3
+          clr    r0          ; Exact at the first pixel, dithered after
+          clr    r2
+          clr    r4
+          clr    r6
+          ldd    r18,Z+SEGSTEP
+          ldd    r19,Z+SEGSTEP+1
+          ldd    r20,Z+SEGSTEP+2
+          ldd    r21,Z+SEGSTEP+3
+          ldd    r22,Z+SEGSTEP+4
+          ldd    r23,Z+SEGSTEP+5
+          ldd    r24,Z+SEGSTEP+6
+          ldd    r25,Z+SEGSTEP+7
+          rcall  Run
+
+col8:     adiw   r30,SEGSIZE
+          dec    r29
+          brne   col4
+
+;         Base colour to the end of the strip
 
-          ldi    r29,(144)>>8
-          ldi    r28,(144)&0xFF
+          ldi    r28,144
+          sub    r28,r9
+          breq   col10
+          rcall  BaseRun
+
+col10:    ret
 
-col4:     mov    r16,r13     ; Send green
-          rcall  LedByte
 
-          mov    r16,r12     ; Send red
-          rcall  LedByte
 
-          mov    r16,r14     ; Send blue
-          rcall  LedByte
 
-          mov    r16,r15     ; Send warm white
-          rcall  LedByte
 
-          sbiw   r28,1
-          brne   col4
 
+;;;       Divide - 16 bit unsigned division
+;;
+;;        entry  r17:r16 - dividend
+;;               r19:r18 - divisor, not zero
+;;
+;;        exit   r17:r16 - quotient
+;;               r21:r20 - remainder
+;;               r22     - clobbered
+
+Divide:   clr    r20
+          clr    r21
+          ldi    r22,16
+
+div2:     lsl    r16         ; Next dividend bit into remainder
+          rol    r17
+          rol    r20
+          rol    r21
+          brcs   div4        ; Remainder over 16 bits is certainly >= divisor
+          cp     r20,r18
+          cpc    r21,r19
+          brcs   div6
+div4:     sub    r20,r18
+          sbc    r21,r19
+          inc    r16         ; Quotient bit is 1
+
+div6:     dec    r22
+          brne   div2
+          ret
+
+
+
+
+
+
+;;;       SetSegment - store the segment in a MSGSEGMENT message
+
+SetSegment:
+          lds    r16,PACKET+1 ; Strip mask
+          and    r16,r11
+          breq   ss12
+
+          lds    r17,PACKET+3 ; First pixel
+          cpi    r17,144
+          brsh   ss12         ; Off the end of the strip
+
+          ldi    r16,144
+          sub    r16,r17      ; Pixels from first to end of strip
+          lds    r18,PACKET+4 ; Length
+          cp     r16,r18
+          brsh   ss2
+          mov    r18,r16      ; Clip to end of strip
+
+ss2:      lds    r16,PACKET+2 ; Slot
+          andi   r16,NSEG-1
+          mov    r19,r16
+          lsl    r19          ; 2 * slot
+          swap   r16          ; 16 * slot
+          sub    r16,r19      ; 14 * slot
+          ldi    r30,lo8(SEGMENTS)
+          ldi    r31,hi8(SEGMENTS)
+          clr    r19
+          add    r30,r16
+          adc    r31,r19
+
+          st     Z+,r17       ; First pixel
+          st     Z+,r18       ; Length
+          tst    r18
+          breq   ss12         ; Slot now unused
+
+          ldi    r28,lo8(PACKET+5)
+          ldi    r29,hi8(PACKET+5)
+          ldi    r24,4
+ss4:      ld     r16,Y+       ; Starting colour
+          st     Z+,r16
+          dec    r24
+          brne   ss4
+
+;         Step for each channel is (last - first) * 256 / (length - 1)
+
+          ldi    r28,lo8(PACKET+5)
+          ldi    r29,hi8(PACKET+5)
+          dec    r18          ; Steps between first and last pixel
+          clr    r19
+          ldi    r24,4
+
+ss6:      ldd    r17,Y+4      ; Last
+          ld     r16,Y+       ; First
+          clr    r25          ; Rising
+          sub    r17,r16
+          brcc   ss8
+          neg    r17          ; Falling, divide the magnitude
+          ldi    r25,1
+
+ss8:      clr    r16
+          tst    r18
+          brne   ss9
+          clr    r17          ; Single pixel, no step
+          rjmp   ss10
+
+ss9:      rcall  Divide
+          tst    r25
+          breq   ss10
+          com    r17          ; Negate r17:r16
+          neg    r16
+          sbci   r17,-1
+
+ss10:     st     Z+,r16
+          st     Z+,r17
+          dec    r24
+          brne   ss6
+
+ss12:     ret
+
+
+
+
+
+
+;;;       Fine - unpack our sixteenths from a colour or fade message
+;;
+;;        entry  r31:r30 - where to store red, green, blue and warm white
+;;                         fractions
+
+Fine:     mov    r16,r10
+          lsr    r16          ; 1+2n
+          ldi    r26,lo8(PACKET+19)
+          ldi    r27,hi8(PACKET+19)
+          add    r26,r16      ; 20+2n, never crosses a 256 byte boundary
+          ldi    r24,2
+
+fi2:      ld     r16,X+
+          mov    r17,r16
+          andi   r16,0xF0     ; Red or blue
+          st     Z+,r16
+          swap   r17
+          andi   r17,0xF0     ; Green or warm white
+          st     Z+,r17
+          dec    r24
+          brne   fi2
+          ret
+
+
+
+
+
+
+;;;       StartFade - start the fade in a MSGFADE message
+;;
+;;        Note, the colour registers are read through their data space
+;;        addresses 12..15 so that the channels can be looped over.
+
+StartFade:
+          lds    r16,PACKET+1 ; Dirty mask
+          and    r16,r11
+          breq   sf12
+
+          ldi    r26,lo8(PACKET)
+          ldi    r27,hi8(PACKET)
+          add    r26,r10      ; Our target
+          ldi    r30,lo8(FADE+FADETARGET)
+          ldi    r31,hi8(FADE+FADETARGET)
+          ldi    r24,4
+sf2:      ld     r16,X+
+          st     Z+,r16
+          dec    r24
+          brne   sf2
+
+          ldi    r30,lo8(FADE+FADEFINE)
+          ldi    r31,hi8(FADE+FADEFINE)
+          rcall  Fine
+
+          lds    r18,PACKET+18 ; Frames
+          lds    r19,PACKET+19
+
+
+;;        FadeTo - start a fade to the target in FADE over r19:r18 frames
+
+FadeTo:   sts    FADE+FADEFRAMES,r18
+          sts    FADE+FADEFRAMES+1,r19
+          mov    r16,r18
+          or     r16,r19
+          brne   sf4
+          rjmp   FadeEnd      ; No frames, take the target at once
+
+;         Step for each channel is (target - colour) / frames in 8.8
+
+sf4:      ldi    r28,12       ; r12
+          clr    r29
+          ldi    r30,lo8(FADE)
+          ldi    r31,hi8(FADE)
+          ldi    r24,4
+
+sf6:      ldd    r16,Z+FADEFINE ; Target
+          ldd    r17,Z+FADETARGET
+          ldd    r20,Z+FINE-FADE ; Colour
+          ld     r21,Y+
+          clr    r25          ; Rising
+          sub    r16,r20
+          sbc    r17,r21
+          brcc   sf8
+          com    r17          ; Falling, divide the magnitude
+          neg    r16
+          sbci   r17,-1
+          ldi    r25,1
+sf8:      rcall  Divide
+          tst    r25
+          breq   sf10
+          com    r17          ; Negate r17:r16
+          neg    r16
+          sbci   r17,-1
+sf10:     std    Z+FADESTEP,r16
+          std    Z+FADESTEP+4,r17
+          adiw   r30,1
+          dec    r24
+          brne   sf6
+
+sf12:     ret
+
+
+
+
+
+
+;;;       FadeFrame - step the fade in progress by one frame
+;;
+;;        exit   r12..r15, FINE - colour for this frame
+
+FadeFrame:
+          lds    r24,FADE+FADEFRAMES
+          lds    r25,FADE+FADEFRAMES+1
+          sbiw   r24,1
+          sts    FADE+FADEFRAMES,r24
+          sts    FADE+FADEFRAMES+1,r25
+          breq   FadeEnd      ; Last frame lands on the target
+
+          ldi    r30,lo8(FADE)
+          ldi    r31,hi8(FADE)
+          ldi    r28,12       ; r12
+          clr    r29
+          ldi    r18,4
+
+ff2:      ldd    r16,Z+FINE-FADE ; Fraction
+          ldd    r17,Z+FADESTEP
+          add    r16,r17
+          std    Z+FINE-FADE,r16
+          ld     r16,Y        ; Colour
+          ldd    r17,Z+FADESTEP+4
+          adc    r16,r17
+          st     Y+,r16
+          adiw   r30,1
+          dec    r18
+          brne   ff2
+          ret
+
+
+;;        FadeEnd - take the fade target as the colour
+
+FadeEnd:  lds    r12,FADE+FADETARGET
+          lds    r13,FADE+FADETARGET+1
+          lds    r14,FADE+FADETARGET+2
+          lds    r15,FADE+FADETARGET+3
+          ldi    r30,lo8(FADE)
+          ldi    r31,hi8(FADE)
+          ldi    r18,4
+fe2:      ldd    r16,Z+FADEFINE
+          std    Z+FINE-FADE,r16
+          adiw   r30,1
+          dec    r18
+          brne   fe2
+          ret
+
+
+
+
+
+
+;;;       StoreScene - store the scene in a MSGSTORE message
+
+StoreScene:
+          lds    r16,PACKET+1 ; Strip mask
+          and    r16,r11
+          breq   st4
+
+          lds    r19,PACKET+18 ; Scene
+          andi   r19,SCENES-1
+          lds    r16,STORE
+          cp     r16,r19
+          breq   st2          ; Being written, replace what is left
+          rcall  EEFlush
+          lds    r19,PACKET+18
+          andi   r19,SCENES-1
+
+st2:      sts    STORE,r19
+          clr    r16
+          sts    STORE+1,r16
+
+          ldi    r26,lo8(PACKET)
+          ldi    r27,hi8(PACKET)
+          add    r26,r10      ; Our colour
+          ldi    r30,lo8(STORE+2)
+          ldi    r31,hi8(STORE+2)
+          ldi    r24,4
+st3:      ld     r16,X+
+          st     Z+,r16
+          dec    r24
+          brne   st3
+          rcall  Fine         ; Fractions follow
+
+          sts    RING,r19     ; Last scene
+st4:      ret
+
+
+
+
+;;;       RecallScene - fade to the scene in a MSGRECALL message
+;;
+;;        A scene never stored is ignored.
+
+RecallScene:
+          lds    r16,PACKET+1 ; Strip mask
+          and    r16,r11
+          breq   rc2
+
+          rcall  EEFlush
+          lds    r19,PACKET+2 ; Scene
+          andi   r19,SCENES-1
+          rcall  LoadScene
+          brcs   rc2
+          sts    RING,r19     ; Last scene
+
+          lds    r18,PACKET+3 ; Frames
+          lds    r19,PACKET+4
+          rjmp   FadeTo
+
+rc2:      ret
+
+
+
+
+;;;       LoadScene - read a scene from eeprom into the fade target
+;;
+;;        entry  r19 - scene
+;;
+;;        exit   carry set if the scene was never stored
+
+LoadScene:
+          mov    r20,r19
+          lsl    r20
+          lsl    r20
+          lsl    r20
+          subi   r20,lo8(-(EESCENES)) ; Its first byte
+
+          mov    r16,r20
+          subi   r16,-4       ; Red fraction
+          rcall  ReadEEProm
+          andi   r16,0x0F
+          breq   ls2
+          sec                 ; Erased
+          ret
+
+ls2:      ldi    r30,lo8(FADE)
+          ldi    r31,hi8(FADE)
+          ldi    r21,4
+ls4:      mov    r16,r20
+          rcall  ReadEEProm
+          std    Z+FADETARGET,r16
+          mov    r16,r20
+          subi   r16,-4
+          rcall  ReadEEProm
+          std    Z+FADEFINE,r16
+          inc    r20
+          adiw   r30,1
+          dec    r21
+          brne   ls4
+          clc
+          ret
+
+
+
+
+;;;       FindRing - find the last scene in the ring and where the next goes
+;;
+;;        exit   r19 - last scene, SCENES or more if none
+
+FindRing:
+          ldi    r16,EERING
+          rcall  ReadEEProm
+          mov    r18,r16
+          andi   r18,0x80     ; Entry 0's pass
+          ldi    r17,1
+
+fr2:      mov    r16,r17
+          subi   r16,lo8(-(EERING))
+          rcall  ReadEEProm
+          andi   r16,0x80
+          cp     r16,r18
+          brne   fr4          ; Entry r17 is from the pass before
+          inc    r17
+          cpi    r17,16
+          brne   fr2
+
+fr4:      mov    r16,r17
+          subi   r16,lo8(-(EERING-1))
+          rcall  ReadEEProm
+          mov    r19,r16
+          andi   r19,0x7F
+
+          cpi    r17,16
+          brne   fr6
+          clr    r17          ; Ring full this pass, start the next
+          ldi    r16,0x80
+          eor    r18,r16
+
+fr6:      sts    RING+1,r17
+          sts    RING+2,r18
+          ldi    r16,0xFF
+          sts    RING,r16
+          ret
+
+
+
+
+;;;       EEStep - write the next byte of a stored scene, or the ring
+;;
+;;        Returns at once if a write is in progress.
+
+EEStep:   sbic   EECR,1       ; EEPE
+          ret
+
+          lds    r19,STORE
+          cpi    r19,0xFF
+          breq   es4          ; No scene being written
+
+          lds    r20,STORE+1
+          cpi    r20,SCENESIZE
+          brsh   es2          ; All written
+          inc    r20
+          sts    STORE+1,r20
+          dec    r20
+
+          mov    r17,r19      ; Address
+          lsl    r17
+          lsl    r17
+          lsl    r17
+          subi   r17,lo8(-(EESCENES))
+          add    r17,r20
+          ldi    r30,lo8(STORE+2)
+          ldi    r31,hi8(STORE+2)
+          add    r30,r20      ; Never crosses a 256 byte boundary
+          ld     r18,Z
+          rjmp   WriteEEProm
+
+es2:      ldi    r16,0xFF
+          sts    STORE,r16
+
+es4:      lds    r18,RING
+          cpi    r18,0xFF
+          breq   es8          ; Nothing to append
+          ldi    r16,0xFF
+          sts    RING,r16
+
+          lds    r19,RING+2   ; This pass
+          or     r18,r19
+          lds    r17,RING+1
+          mov    r16,r17
+          inc    r16
+          andi   r16,15
+          sts    RING+1,r16
+          brne   es6
+          ldi    r16,0x80     ; Wrapped, next pass
+          eor    r19,r16
+          sts    RING+2,r19
+es6:      subi   r17,lo8(-(EERING))
+          rjmp   WriteEEProm
+
+es8:      ret
+
+
+;;        EEFlush - finish writing any scene being stored
+
+EEFlush:  rcall  EEStep
+          lds    r16,STORE
+          cpi    r16,0xFF
+          brne   EEFlush
           ret
 
 
@@ -274,6 +1124,7 @@ spi2:     out    USICR,r16
           .equ  STATUS,       0x07
           .equ  RX_ADDR_P0,   0x0A
           .equ  RX_ADDR_P1,   0x0B
+          .equ  RX_ADDR_P2,   0x0C
           .equ  TX_ADDR,      0x10
           .equ  RX_PW_P0,     0x11
           .equ  RX_PW_P1,     0x12
@@ -288,6 +1139,7 @@ spi2:     out    USICR,r16
           .equ  FLUSH_TX,     0xE1
           .equ  FLUSH_RX,     0xE2
           .equ  W_TX_PAYLOAD, 0xA0
+          .equ  W_ACK_PAYLOAD,0xA8 ; | pipe
 
           .macro WriteRfCmd cmd
           cbi    PORTB,CSN   ; Activate nRF24L01+ chip select
@@ -336,8 +1188,12 @@ Status:   cbi    PORTB,CSN   ; Activate nRF24L01+ chip select
 ;         entry r16 - address
 ;
 ;         exit  r16 - loaded value
+;
+;         Waits for any write in progress.
 
 ReadEEProm:
+          sbic  EECR,1                 ; Skip unless writing (EEPE)
+          rjmp  ReadEEProm
           out   EEARL,r16              ; Address 7-0
           ldi   r16,0                  ; Address 15-8 is zero
           out   EEARH,r16
@@ -348,6 +1204,28 @@ ReadEEProm:
 
 
 
+;;;       WriteEEProm - start writing one byte to eeprom, unless it holds it
+;
+;         entry r17 - address
+;               r18 - value
+;
+;         The write then takes 3.4ms, during which eeprom cannot be read.
+
+WriteEEProm:
+          mov   r16,r17
+          rcall ReadEEProm             ; Leaves the address in EEAR
+          cp    r16,r18
+          breq  we2                    ; Already holds it
+          out   EEDR,r18
+          ldi   r16,0                  ; EEPM = 0: erase and write
+          out   EECR,r16
+          sbi   EECR,2                 ; EEMPE, then EEPE within 4 cycles
+          sbi   EECR,1
+we2:      ret
+
+
+
+
 
 
 ;;;       WirelessInit
@@ -360,27 +1238,22 @@ WirelessInit:
           WriteRfCmd FLUSH_TX
           WriteRfReg CONFIG,     0x05  ; Power down (in RX mode) with 2 byte CRCs
           MSEC  5
-;         WriteRfReg SETUP_RETR, 0x34  ; 1ms per retry, 4 retries
-          WriteRfReg EN_AA,      0x00  ; Disable auto acknowledgement
+          WriteRfReg EN_AA,      0x04  ; Auto acknowledge on pipe 2, our own address, only
           WriteRfReg RF_SETUP,   0x04  ; 1Mbps data rate, -6dBm power
-          WriteRfReg FEATURE,    0x00  ; Disable EN_DPL, EN_ACK_PAY and EN_DYN_ACK
-          WriteRfReg DYNPD,      0x00  ; Disable dynamic payload on all pipes
+          WriteRfReg FEATURE,    0x06  ; EN_DPL and EN_ACK_PAY, for telemetry in acknowledgements
+          WriteRfReg DYNPD,      0x04  ; Dynamic payload on pipe 2, needed for ACK payloads
           WriteRfReg STATUS,     0x70  ; Clear all three interrupt flags
           WriteRfReg RF_CH,        76  ; This channel should be universally safe and not bleed over into adjacent spectrum.
           WriteRfCmd FLUSH_TX
           WriteRfCmd FLUSH_RX
 
-;         Set our wireless address
+;         Set our wireless address, shared by all strips
 
           cbi    PORTB,CSN   ; Activate nRF24L01+ chip select
           ldi    r16,0x20|RX_ADDR_P1
           rcall  spi
 
-;         ldi   r16,1                  ; Our address is stored in eeprom location 1
-;         rcall ReadEEProm
-;         subi  r16,-'1'
-          
-          ldi   r16,'1'
+          ldi   r16,'0'
           rcall spi
 
           ldi   r16,'5'
@@ -396,8 +1269,24 @@ WirelessInit:
           rcall spi
           sbi   PORTB,CSN   ; Activate nRF24L01+ chip select
 
-          WriteRfReg RX_PW_P1,   4     ; Payload length
-          WriteRfReg EN_RXADDR,  2     ; Enable Rx on pipe 1
+          WriteRfReg RX_PW_P1,   PAYLOAD ; Payload length
+
+;         and our own, "n5925", which shares all but its first byte
+
+          ldi    r16,1       ; Strip number stored value
+          rcall  ReadEEProm
+          andi   r16,3
+          subi   r16,-'1'
+          mov    r18,r16
+
+          cbi    PORTB,CSN   ; Activate nRF24L01+ chip select
+          ldi    r16,0x20|RX_ADDR_P2
+          rcall  spi
+          mov    r16,r18
+          rcall  spi
+          sbi    PORTB,CSN   ; Activate nRF24L01+ chip select
+
+          WriteRfReg EN_RXADDR,  6     ; Enable Rx on pipes 1 and 2
 
           WriteRfReg CONFIG,     0x0F  ; Power up in RX mode with 2 byte CRCs
           MSEC  5
@@ -406,6 +1295,30 @@ WirelessInit:
 
 
 
+;;;       AckPayload - load the telemetry for the next acknowledgement on
+;;;       our own address, replacing any not yet sent
+;
+;         The ACK payload waits in the TX FIFO until a message arrives on
+;         pipe 2, so it describes the message before that one.
+
+AckPayload:
+          WriteRfCmd FLUSH_TX
+          cbi   PORTB,CSN    ; Activate nRF24L01+ chip select
+          ldi   r16,W_ACK_PAYLOAD|2
+          rcall spi
+          ldi   r26,lo8(TELEMETRY)
+          ldi   r27,hi8(TELEMETRY)
+          ldi   r18,TELSIZE
+ap2:      ld    r16,X+
+          rcall spi
+          dec   r18
+          brne  ap2
+          sbi   PORTB,CSN    ; Activate nRF24L01+ chip select
+          ret
+
+
+
+
 
 
 ;;;;      Initialisation
@@ -421,12 +1334,12 @@ WirelessInit:
 
 reset:
 
-;         Set stack pointer to allow 32 bytes above IO space for stack
+;         Set stack pointer to the top of SRAM
 
-          ldi    r16,0x7f
+          ldi    r16,lo8(RAMEND)
           out    SPL,r16
 
-          ldi    r16,0
+          ldi    r16,hi8(RAMEND)
           out    SPH,r16
 
 
@@ -473,9 +1386,55 @@ reset:
           out    DDRB,r16
 
 
-;         Set initial LED colour
+;         Empty the segment table
+
+          ldi    r30,lo8(SEGMENTS)
+          ldi    r31,hi8(SEGMENTS)
+          ldi    r17,NSEG
+          clr    r16
+in2:      std    Z+SEGLEN,r16
+          adiw   r30,SEGSIZE
+          dec    r17
+          brne   in2
+
+          sts    FADE+FADEFRAMES,r16   ; Not fading
+          sts    FADE+FADEFRAMES+1,r16
+
+          sts    FINE,r16              ; Whole levels
+          sts    FINE+1,r16
+          sts    FINE+2,r16
+          sts    FINE+3,r16
+          sts    DITHER,r16
+
+          sts    TELEMETRY+TELSEQUENCE,r16
+          sts    TELEMETRY+TELFRAME,r16
+          sts    TELEMETRY+TELOVERFLOW,r16
+
+
+;         Timer0 marks fade frames: CTC at clk/1024 / 156 = 50Hz
+
+          ldi    r16,0x02    ; WGM0 = 2: clear timer on compare match
+          out    TCCR0A,r16
+          ldi    r16,155
+          out    OCR0A,r16
+          ldi    r16,0x05    ; Clock select clk/1024
+          out    TCCR0B,r16
+
+
+;         Set initial LED colour: the last scene stored or recalled, else
+;         the stored power up colour
 
-          ldi    r16,2       ; Red stored value
+          ldi    r16,0xFF    ; No scene being written
+          sts    STORE,r16
+          rcall  FindRing
+          cpi    r19,SCENES
+          brsh   in4         ; None
+          rcall  LoadScene
+          brcs   in4         ; Never stored
+          rcall  FadeEnd
+          rjmp   in6
+
+in4:      ldi    r16,2       ; Red stored value
           rcall  ReadEEProm
           mov    r12,r16
 
@@ -491,49 +1450,157 @@ reset:
           rcall  ReadEEProm
           mov    r15,r16
 
-          rcall  SetColour
+in6:      rcall  SetColour
+
+;         Find our slot in colour messages
+
+          ldi    r16,1       ; Strip number stored value
+          rcall  ReadEEProm
+          andi   r16,3       ; Unprogrammed eeprom reads as strip 0
+
+          mov    r17,r16
+          lsl    r17
+          lsl    r17
+          subi   r17,-2      ; 2+4n
+          mov    r10,r17
+
+          ldi    r17,1
+rs2:      subi   r16,1       ; Shift mask bit left n times
+          brcs   rs4
+          lsl    r17
+          rjmp   rs2
+rs4:      mov    r11,r17     ; 1<<n
 
 ;         Initialise the nRF24L01+
 
           rcall  WirelessInit
+          rcall  AckPayload
 
-;         Wait for incoming led colour settings
+;         Step any fade in progress once a fade frame
 
-led2:     rcall Status       ; Wait for completion status
-          sbrs  r16,6        ; Skip if receive data ready (RX_DR)
+led1:     in    r16,TIFR
+          sbrs  r16,OCF0A    ; Skip if the frame time has come
           rjmp  led2
+          ldi   r16,1<<OCF0A ; Clear the flag
+          out   TIFR,r16
+          lds   r24,FADE+FADEFRAMES
+          lds   r25,FADE+FADEFRAMES+1
+          or    r24,r25
+          breq  led2         ; Not fading
+          rcall FadeFrame
 
-;         Read updated led settings
+;         Between frames, check for incoming led colour settings. A packet
+;         arriving during a frame waits at most one frame.
+
+led2:     rcall Status       ; Wait for completion status
+          sbrc  r16,6        ; Skip unless receive data ready (RX_DR)
+          rjmp  led3
+          rcall EEStep       ; Write a byte of any scene change
+
+          in    r16,TCNT0    ; Time the refresh for the telemetry
+          sts   REFRESHAT,r16
+          rcall SetColour    ; Refresh the strip
+          in    r16,TCNT0
+          lds   r17,REFRESHAT
+          sub   r16,r17
+          brcc  led11
+          subi  r16,-156     ; Timer 0 passed its compare match
+led11:    sts   TELEMETRY+TELFRAME,r16
+          rjmp  led1
+
+;         Count the times the RX FIFO filled while we were refreshing, when
+;         any more messages would have been lost
+
+led3:     ReadRfReg FIFO_STATUS
+          sbrs  r16,1        ; Skip if RX_FULL
+          rjmp  led4
+          lds   r16,TELEMETRY+TELOVERFLOW
+          inc   r16
+          breq  led4         ; Stays at 255
+          sts   TELEMETRY+TELOVERFLOW,r16
+
+;         Read the message into SRAM, noting the pipe it came on
 
 led4:     cbi   PORTB,CSN    ; Activate nRF24L01+ chip select
           ldi   r16,0x61     ; Read RX payload
           rcall spi
-          ldi   r16,0xFF
-          rcall spi
-          mov   r12,r16      ; Red
-          ldi   r16,0xFF
-          rcall spi
-          mov   r13,r16      ; Green
-          ldi   r16,0xFF
+          sts   PACKETSTATUS,r16
+          ldi   r26,lo8(PACKET)
+          ldi   r27,hi8(PACKET)
+          ldi   r18,PAYLOAD
+led5:     ldi   r16,0xFF
           rcall spi
-          mov   r14,r16      ; Blue
-          ldi   r16,0xFF
-          rcall spi
-          mov   r15,r16      ; Warm white
+          st    X+,r16
+          dec   r18
+          brne  led5
           sbi    PORTB,CSN   ; Activate nRF24L01+ chip select
 
+;         Take our colour from a colour message that marks it as changed,
+;         our segment from a segment message, and so on. Other messages,
+;         and messages for other strips, are ignored.
+
+          lds   r16,PACKET
+          cpi   r16,MSGSEGMENT
+          brne  led6
+          rcall SetSegment
+          rjmp  led8
+
+led6:     cpi   r16,MSGFADE
+          brne  led9
+          rcall StartFade
+          rjmp  led8
+
+led9:     cpi   r16,MSGSTORE
+          brne  led10
+          rcall StoreScene
+          rjmp  led8
+
+led10:    cpi   r16,MSGRECALL
+          brne  led7
+          rcall RecallScene
+          rjmp  led8
+
+led7:     cpi   r16,MSGCOLOURS
+          brne  led8
+          lds   r16,PACKET+1 ; Dirty mask
+          and   r16,r11
+          breq  led8
+
+          ldi   r26,lo8(PACKET)
+          ldi   r27,hi8(PACKET)
+          add   r26,r10      ; Our slot, never crosses a 256 byte boundary
+          ld    r12,X+       ; Red
+          ld    r13,X+       ; Green
+          ld    r14,X+       ; Blue
+          ld    r15,X+       ; Warm white
+          ldi   r30,lo8(FINE)
+          ldi   r31,hi8(FINE)
+          rcall Fine
+          clr   r16          ; Cancel any fade
+          sts   FADE+FADEFRAMES,r16
+          sts   FADE+FADEFRAMES+1,r16
+
+;         A message to our own address updates the telemetry for the next
+;         acknowledgement
+
+led8:     lds   r16,PACKETSTATUS
+          andi  r16,0x0E     ; RX_P_NO
+          cpi   r16,2<<1
+          brne  led12
+          lds   r16,PACKET+SEQUENCE
+          sts   TELEMETRY+TELSEQUENCE,r16
+          rcall AckPayload
+
 ;         If there are any more settings in our received packet pipeline
 ;         we'll want to pick them up now so that we're always using the
 ;         most recent setting.
 
-          ReadRfReg FIFO_STATUS
+led12:    ReadRfReg FIFO_STATUS
           sbrs  r16,0        ; Skip if all pending payloads have been read
           rjmp  led4         ; Immediately read next payload
 
           WriteRfReg STATUS,0x40 ; Clear RX_DR data ready interrupt flag
 
-          rcall SetColour    ; Send the updated colour to all leds
-
-;         Go back and wait for another packet
+;         Go back to refreshing the strip, now with any new setting
 
-          rjmp led2          ; Wait for another setting
+          rjmp led1
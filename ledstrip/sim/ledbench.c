@@ -0,0 +1,360 @@
+// ledbench - run ledstrip.elf under simavr, check the SK6812 waveform on
+// PB4 and report frame timing.
+//
+// Usage: ledbench ledstrip.elf
+//
+// Every high pulse must fall in the 0 or 1 bit window noted at LedByte,
+// and every low between the bits of a byte in the window for the bit before
+// it. Lows between bytes may stretch, but must stay short of the 80us reset.
+// Frames are decoded into pixels and compared with what the messages sent
+// should show:
+//
+//   boot     the eeprom colour
+//   colour   a MSGCOLOURS message
+//   segment  a MSGSEGMENT gradient over the colour, dithered
+//   fade     a MSGFADE over 10 fade frames, landing on its target and its
+//            sixteenths
+//   dither   a MSGCOLOURS message with sixteenths, one channel at 255
+//   recall   a MSGSTORE then a MSGRECALL of the scene, with its eeprom and
+//            ring entries; a MSGRECALL of a scene never stored is ignored
+//   telemetry messages to the strip's own address leave their sequence
+//            number, the refresh time and a count of RX FIFO overflows in
+//            the ACK payload for the next, three at once overflowing
+//   power up the chip restarted with that eeprom shows the scene
+//
+// Whole levels must show exactly in every frame. Where there is a fraction
+// each frame must show the level or the one above, and 256 frames must
+// average to exactly the level and fraction.
+//
+// Reports RX_DR to first LED bit, RX_DR to end of frame, the bit stream
+// time and the resulting refresh rates. Exits non zero on any failure.
+//
+// Not yet run: simavr was not at hand when it was written, so neither its
+// checks nor its timings have been seen to pass.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "avr_ioport.h"
+#include "avr_eeprom.h"
+
+#include "nrfsim.h"
+
+#define MHZ      8
+#define NS(c)    ((c) * 1000 / MHZ)    // Cycles to ns
+#define MS(m)    ((uint64_t)(m) * 1000 * MHZ)
+#define PIXELS   144
+#define RESET    (80 * MHZ)            // SK6812 reset: 80us low
+#define FRAMES   32                    // Frames kept
+#define AVERAGE  256                   // Frames over which dithering is exact
+#define SETTLE   (200 * MHZ)           // RX_DR to the start of a frame that may show it
+#define EEPROM   256                   // As the ATtiny45 programmed by the Makefile
+
+avr_t      *avr;
+struct nrf  nrf;
+struct usi  usi;
+int         failures;
+
+void Fail(const char *format, uint64_t a, uint64_t b) {
+  if (failures++ < 10) {fprintf(stderr, format, a, b); fputc('\n', stderr);}
+}
+
+
+// PB4 waveform
+
+struct frame {
+  uint64_t start, end;                 // First rising edge, end of last bit
+  int      bits;
+  uint8_t  pixel[PIXELS][4];           // Red, green, blue, warm white
+} frame, frames[FRAMES];
+int nframes;
+
+#define Frame(i) (&frames[(i) % FRAMES])
+
+uint64_t rise, fall;                   // Last edges
+int      level, lastbit = -1, stretches;
+uint64_t maxstretch;
+
+void Sum(struct frame *f);
+
+void EndFrame() {
+  if (frame.bits != PIXELS*32) Fail("Frame of %lu bits, expected %lu.", frame.bits, PIXELS*32);
+  *Frame(nframes++) = frame;
+  Sum(&frame);
+  frame.bits = 0;
+}
+
+void Bit(int bit) {
+  int byte = frame.bits / 8, pixel = byte / 4;
+  static const int order[4] = {1, 0, 2, 3};         // Sent as green, red, blue, warm white
+  if (pixel < PIXELS) {
+    uint8_t *p = &frame.pixel[pixel][order[byte % 4]];
+    *p = (*p << 1) | bit;
+  }
+  frame.bits++;
+}
+
+void Led(avr_irq_t *irq, uint32_t value, void *param) {
+  (void)irq; (void)param;
+  uint64_t now = avr->cycle;
+  if (value == (uint32_t)level) return;
+  level = value;
+  if (value) {                         // Rising: check the low before it
+    uint64_t low = now - fall;
+    if (lastbit < 0  ||  low >= RESET) {
+      if (lastbit >= 0) EndFrame();
+      memset(&frame, 0, sizeof frame);
+      frame.start = now;
+    } else if (frame.bits % 8) {       // Within a byte
+      uint64_t min = lastbit ? 450 : 750, max = lastbit ? 750 : 1050;
+      if (NS(low) < min  ||  NS(low) > max) Fail("Low of %luns after a %lu bit.", NS(low), lastbit);
+    } else if (NS(low) > (lastbit ? 750 : 1050)) {
+      stretches++;
+      if (low > maxstretch) maxstretch = low;
+    }
+    rise = now;
+  } else {                             // Falling: the high is a bit
+    uint64_t high = NS(now - rise);
+    if      (high >= 150  &&  high <= 450) lastbit = 0;
+    else if (high >  450  &&  high <= 750) lastbit = 1;
+    else {Fail("High of %luns at bit %lu.", high, frame.bits); lastbit = 0;}
+    Bit(lastbit);
+    fall = now;
+    frame.end = now + (lastbit ? 5 : 7);            // Including the bit's low
+  }
+}
+
+
+// Expected pixels: level and fraction (/256) of each channel
+
+uint8_t expect[PIXELS][4], fine[PIXELS][4];
+
+void Fill(const uint8_t *c, const uint8_t *sixteenths) { // Colour and its two bytes of sixteenths
+  uint8_t f[4] = {0};
+  if (sixteenths) {
+    f[0] = sixteenths[0] & 0xF0;  f[1] = sixteenths[0] << 4;
+    f[2] = sixteenths[1] & 0xF0;  f[3] = sixteenths[1] << 4;
+  }
+  for (int i=0; i<PIXELS; i++) {memcpy(expect[i], c, 4);  memcpy(fine[i], f, 4);}
+}
+
+void Gradient(int start, int length, const uint8_t *a, const uint8_t *b) { // As SetSegment and Run
+  for (int ch=0; ch<4; ch++) {
+    uint16_t step = 0;
+    if (length > 1) {
+      uint16_t q = (uint16_t)(abs(b[ch] - a[ch]) * 256 / (length-1));
+      step = b[ch] < a[ch] ? (uint16_t)-q : q;
+    }
+    uint16_t acc = a[ch] << 8;
+    for (int i=start; i<start+length  &&  i<PIXELS; i++) {
+      expect[i][ch] = acc >> 8;  fine[i][ch] = acc;
+      acc += step;
+    }
+  }
+}
+
+void Compare(const char *name, struct frame *f) { // A frame of whole levels
+  for (int i=0; i<PIXELS; i++) if (memcmp(f->pixel[i], expect[i], 4)) {
+    fprintf(stderr, "%s: pixel %d is %02x %02x %02x %02x, expected %02x %02x %02x %02x.\n", name, i,
+      f->pixel[i][0], f->pixel[i][1], f->pixel[i][2], f->pixel[i][3],
+      expect[i][0], expect[i][1], expect[i][2], expect[i][3]);
+    failures++;
+    return;
+  }
+}
+
+
+// Dithered frames, summed from a given cycle
+
+uint32_t sum[PIXELS][4];
+int      summed;
+uint64_t sumfrom = UINT64_MAX;
+const char *sumname;
+
+void Sum(struct frame *f) {
+  if (f->start < sumfrom  ||  summed >= AVERAGE) return;
+  for (int i=0; i<PIXELS; i++) for (int ch=0; ch<4; ch++) {
+    int p = f->pixel[i][ch], e = expect[i][ch];
+    if (p != e  &&  !(fine[i][ch]  &&  e < 255  &&  p == e+1)) {
+      if (failures++ < 10) fprintf(stderr, "%s: frame %d pixel %d channel %d is %02x, expected %02x%s.\n",
+        sumname, summed, i, ch, p, e, fine[i][ch] ? " or the one above" : "");
+    }
+    sum[i][ch] += p;
+  }
+  summed++;
+}
+
+
+// Simulation
+
+void RunUntil(uint64_t cycle) {
+  while (avr->cycle < cycle) {
+    int state = avr_run(avr);
+    if (state == cpu_Done  ||  state == cpu_Crashed) {fprintf(stderr, "Simulation stopped.\n"); exit(2);}
+  }
+}
+
+uint64_t Send(const uint8_t *payload) { // Returns cycle of RX_DR. Frames starting SETTLE after show it.
+  while (!NrfListening(&nrf)) RunUntil(avr->cycle + MS(1));
+  NrfReceive(&nrf, payload);
+  return avr->cycle;
+}
+
+int WaitFrames(uint64_t after, int count, uint64_t timeout) { // Returns index of the first of count frames starting after cycle after
+  int first = nframes;
+  uint64_t end = avr->cycle + timeout;
+  for (;;) {
+    while (first < nframes  &&  Frame(first)->start < after) first++;
+    if (nframes >= first + count) return first;
+    if (avr->cycle >= end) {Fail("%lu frames, expected %lu.", nframes - first, count); exit(1);}
+    RunUntil(avr->cycle + MS(1));
+    if (frame.bits == PIXELS*32  &&  avr->cycle - fall >= RESET) {EndFrame(); lastbit = -1;}
+  }
+}
+
+void Average(const char *name, uint64_t from) { // Sums AVERAGE frames starting after cycle from
+  memset(sum, 0, sizeof sum);  summed = 0;  sumfrom = from;  sumname = name;
+  WaitFrames(from, AVERAGE, MS(AVERAGE * 10));
+  sumfrom = UINT64_MAX;
+  for (int i=0; i<PIXELS; i++) for (int ch=0; ch<4; ch++) {
+    uint32_t want = expect[i][ch] == 255 ? 255*AVERAGE : expect[i][ch]*AVERAGE + fine[i][ch];
+    if (sum[i][ch] != want) {
+      fprintf(stderr, "%s: pixel %d channel %d sums to %u over %d frames, expected %u.\n", name, i, ch, sum[i][ch], AVERAGE, want);
+      failures++;
+      return;
+    }
+  }
+}
+
+void CheckAck(const char *name, int sequence, int overflows, uint64_t stream) { // The ACK payload for strip 0's next message
+  struct nrfpayload *t = &nrf.tx[0];
+  uint64_t refresh = t->data[1] * 1024;  // Timer 0 counts to cycles
+  if (nrf.txcount != 1  ||  t->pipe != 2  ||  t->len != 3)
+    fprintf(stderr, "%s: %d ACK payloads, the first for pipe %d of %d bytes, expected one for pipe 2 of 3.\n", name, nrf.txcount, t->pipe, t->len);
+  else if (t->data[0] != sequence  ||  t->data[2] != overflows)
+    fprintf(stderr, "%s: sequence %d and %d overflows, expected %d and %d.\n", name, t->data[0], t->data[2], sequence, overflows);
+  else if (refresh + 1024 < stream  ||  refresh > 2*stream)
+    fprintf(stderr, "%s: refresh of %.2fms for a %.2fms bit stream.\n", name, refresh / (MHZ*1000.0), stream / (MHZ*1000.0));
+  else return;
+  failures++;
+}
+
+void Report(const char *name, double value, const char *unit) {
+  fprintf(stdout, "%-34s %10.2f %s\n", name, value, unit);
+}
+
+elf_firmware_t firmware;
+uint8_t        eeprom[EEPROM];
+
+void PowerUp() { // A fresh chip and radio with the given eeprom
+  avr = avr_make_mcu_by_name("attiny85");
+  if (!avr) {fprintf(stderr, "simavr has no attiny85.\n"); exit(2);}
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->frequency = MHZ * 1000000;       // ledstrip.s sets CLKPR for 8MHz
+
+  avr_eeprom_desc_t ee = {.ee = eeprom, .offset = 0, .size = EEPROM};
+  avr_ioctl(avr, AVR_IOCTL_EEPROM_SET, &ee);
+
+  memset(&frame, 0, sizeof frame);
+  nframes = 0;  level = 0;  lastbit = -1;
+  NrfReset(&nrf);
+  NrfAttachUsi(avr, &usi, &nrf, 'B', 3);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 4), Led, NULL);
+}
+
+void CheckEeprom(const char *name, int at, const uint8_t *want, int n) {
+  avr_eeprom_desc_t ee = {.ee = eeprom, .offset = 0, .size = EEPROM};
+  avr_ioctl(avr, AVR_IOCTL_EEPROM_GET, &ee);
+  for (int i=0; i<n; i++) if (eeprom[at+i] != want[i]) {
+    fprintf(stderr, "%s: eeprom %d is %02x, expected %02x.\n", name, at+i, eeprom[at+i], want[i]);
+    failures++;
+    return;
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {fprintf(stderr, "Usage: ledbench ledstrip.elf\n"); return 2;}
+
+  if (elf_read_firmware(argv[1], &firmware)) {fprintf(stderr, "Cannot read %s.\n", argv[1]); return 2;}
+  memset(eeprom, 0xFF, EEPROM);
+  memcpy(eeprom, (uint8_t[]){0xFF, 0, 0x10, 0x20, 0x30, 0x40}, 6);  // Strip 0, initial colour, no scenes
+  PowerUp();
+
+  // Boot
+  struct frame *f = Frame(WaitFrames(0, 1, MS(100)));
+  Fill(eeprom+2, NULL);  Compare("boot", f);
+
+  // Colour
+  uint8_t msg[NRFPAYLOAD] = {1, 1, 0x55, 0xAA, 0x0F, 0xF0};
+  uint64_t rxdr = Send(msg);
+  f = Frame(WaitFrames(rxdr + SETTLE, 1, MS(100)));
+  Fill(msg+2, NULL);  Compare("colour", f);
+  uint64_t latency = f->start - rxdr, frametime = f->end - rxdr, stream = f->end - f->start;
+  int first = WaitFrames(rxdr + SETTLE, 10, MS(100));
+  uint64_t period = (Frame(first+9)->start - Frame(first)->start) / 9;
+
+  // Segment
+  uint8_t seg[NRFPAYLOAD] = {2, 1, 0, 10, 40, 0xFF, 0x00, 0x80, 0x00, 0x00, 0xFF, 0x80, 0x30};
+  Gradient(10, 40, seg+5, seg+9);
+  Average("segment", Send(seg) + SETTLE);
+
+  // Fade, over 10 20ms fade frames to a target with sixteenths
+  uint8_t fade[NRFPAYLOAD] = {3, 1, 0x00, 0x00, 0xFF, 0x00};
+  fade[18] = 10;  fade[20] = 0x3C;  fade[21] = 0x01;
+  rxdr = Send(fade);
+  Fill(fade+2, fade+20);  Gradient(10, 40, seg+5, seg+9);
+  Average("fade", rxdr + MS(12*20));     // Up to a frame to read it, a fade frame to start
+
+  // Dither, with warm white at 255 and a fraction showing 255
+  uint8_t dither[NRFPAYLOAD] = {1, 1, 0x14, 0x00, 0x05, 0xFF};
+  dither[20] = 0x8F;  dither[21] = 0x41;
+  Fill(dither+2, dither+20);  Gradient(10, 40, seg+5, seg+9);
+  Average("dither", Send(dither) + SETTLE);
+
+  // Scenes: store one, recall it, and recall one never stored
+  uint8_t store[NRFPAYLOAD] = {4, 1, 0x20, 0x40, 0x60, 0x80};
+  store[18] = 3;  store[20] = 0x5A;  store[21] = 0xC3;
+  uint8_t recall[NRFPAYLOAD] = {5, 1, 3, 0, 0};
+  Send(store);
+  Fill(store+2, store+20);  Gradient(10, 40, seg+5, seg+9);
+  Average("recall", Send(recall) + SETTLE);
+  recall[2] = 7;
+  Average("recall unstored", Send(recall) + SETTLE);
+  CheckEeprom("store", 32+3*8, (uint8_t[]){0x20, 0x40, 0x60, 0x80, 0x50, 0xA0, 0xC0, 0x30}, 8);
+  CheckEeprom("ring", 16, (uint8_t[]){3, 3, 0xFF}, 3);
+
+  // Telemetry, for strip 0 at "15925"
+  if (nrf.addr[2][0] != '1'  ||  !(nrf.reg[NRFENAA] & 4)  ||  !NrfDynamic(&nrf, 2)  ||  (nrf.reg[NRFFEATURE] & 6) != 6)
+    Fail("Pipe 2 is not strip 0's own address with ACK payloads.", 0, 0);
+  uint8_t own[NRFPAYLOAD] = {1, 1, 0x11, 0x22, 0x33, 0x44};
+  own[31] = 41;
+  NrfPush(&nrf, own, NRFPAYLOAD, 2);
+  WaitFrames(avr->cycle + SETTLE, 1, MS(100));
+  CheckAck("telemetry", 41, 0, stream);
+  for (int i=0; i<3; i++) {own[31] = 42+i;  NrfPush(&nrf, own, NRFPAYLOAD, 2);}
+  WaitFrames(avr->cycle + SETTLE, 1, MS(100));
+  CheckAck("overflow", 44, 1, stream);
+
+  // Power up again in the scene, without the segment
+  PowerUp();
+  Fill(store+2, store+20);
+  Average("power up", 0);
+
+  Report("RX_DR to first LED bit",     latency   / (MHZ*1000.0), "ms");
+  Report("RX_DR to end of frame",      frametime / (MHZ*1000.0), "ms");
+  Report("Bit stream per frame",       stream    / (MHZ*1000.0), "ms");
+  Report("Refresh rate, frame after RX_DR", MHZ*1e6 / frametime, "Hz");
+  Report("Refresh rate, bit stream only",   MHZ*1e6 / stream,    "Hz");
+  Report("Continuous refresh period",  period    / (MHZ*1000.0), "ms");
+  Report("Lows stretched between bytes", stretches, "");
+  Report("Longest stretched low",      NS(maxstretch) / 1000.0,   "us");
+  Report("SPI transactions",           nrf.transactions, "");
+
+  if (failures) {fprintf(stderr, "%d failures.\n", failures); return 1;}
+  return 0;
+}
@@ -0,0 +1,486 @@
+// nrfsim - an nRF24L01+ model for simavr, enough of it for ledstrip.s and
+// the controller's wireless.h.
+//
+// The model answers SPI commands byte by byte: register reads and writes,
+// R_RX_PAYLOAD, R_RX_PL_WID, W_TX_PAYLOAD, W_TX_PAYLOAD_NOACK,
+// W_ACK_PAYLOAD, the flushes and NOP. Packets reach its 3 deep RX FIFO
+// either pushed directly with NrfReceive or NrfPush, with no air timing, or
+// over a struct air joining several models. CE is taken as tied high, as on
+// both boards.
+//
+// Over the air, a powered up transmitter sends the head of its TX FIFO,
+// taking 130us to settle and a bit per us for the preamble, address, packet
+// control field, payload and CRC (NRFAIRBITS at 1Mbps). The packet then
+// arrives, after the air's extra delay unless lost, at every other model
+// that is powered up in RX mode on the same channel, data rate and CRC
+// setting, with an enabled pipe whose address matches TX_ADDR and whose
+// width is the payload's, or which has dynamic payload length. A model
+// that disagrees on any of these, or is not yet listening, counts a
+// mismatch against the reason, which is how the two firmwares' settings are
+// checked against each other. Addresses are 5 bytes.
+//
+// Without auto acknowledgement on pipe 0 (EN_AA), or for a packet written
+// with W_TX_PAYLOAD_NOACK, TX_DS is set as the packet ends. Otherwise the
+// first receiver whose pipe has EN_AA set answers 130us after the packet
+// with an ACK, carrying its first ACK payload for that pipe if any. The ACK
+// may be lost or delayed like any packet. One that reaches the transmitter
+// within the retransmit delay (ARD in SETUP_RETR), on pipe 0 at TX_ADDR,
+// sets TX_DS and puts any payload in the RX FIFO with RX_DR. Otherwise the
+// packet is sent again, up to ARC times, before MAX_RT is set, the packet
+// staying in the TX FIFO and nothing more being sent until MAX_RT is
+// cleared. OBSERVE_TX counts the retransmissions and lost packets. A
+// receiver recognises a retransmission by its packet ID and payload, and
+// acknowledges it again, with the same ACK payload, without receiving it
+// twice. An ACK payload is dropped once the next new packet arrives on its
+// pipe.
+//
+// NrfAttachUsi connects the model to an ATtiny85's USI in three wire mode
+// with software clock strobes, the way ledstrip.s drives it, and to a chip
+// select pin. simavr has no USI, so its registers are emulated here: each
+// USITC strobe in USICR clocks the 4 bit counter, and the sixteenth strobe
+// exchanges the byte with the model and sets USIOIF.
+//
+// NrfAttachSpi connects the model to an ATmega328's hardware SPI, a chip
+// select pin and, unless it is given as -1, the IRQ pin, which the model
+// drives low while an unmasked interrupt flag is set.
+//
+// The model has been exercised on the host against wireless.h, but not yet
+// inside simavr with either firmware.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "sim_avr.h"
+#include "sim_io.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+#include "avr_spi.h"
+
+#define NRFCONFIG     0x00
+#define NRFENAA       0x01
+#define NRFENRXADDR   0x02
+#define NRFSETUPRETR  0x04
+#define NRFRFCH       0x05
+#define NRFRFSETUP    0x06
+#define NRFSTATUS     0x07
+#define NRFOBSERVETX  0x08
+#define NRFRXADDRP0   0x0A
+#define NRFRXPWP0     0x11
+#define NRFFIFOSTATUS 0x17
+#define NRFTXADDR     0x10
+#define NRFDYNPD      0x1C
+#define NRFFEATURE    0x1D
+#define NRFPAYLOAD    32
+#define NRFFIFO       3
+#define NRFSETTLE     130                   // us from standby to sending
+#define NRFAIRBITS    (8 + 40 + 9 + 16)     // Preamble, address, PCF, CRC; plus the payload
+#define NRFNODES      4
+#define NRFFLIGHTS    8                     // Packets and ACKs that may be in the air at once
+
+struct air;
+
+struct nrfpayload {
+  uint8_t  data[NRFPAYLOAD];
+  int      len;
+  int      pipe;                       // RX: pipe received on. TX: -1 to send, else an ACK payload's pipe
+  int      noack;                      // TX: written with W_TX_PAYLOAD_NOACK
+  int      sent;                       // TX: ACK payload sent, dropped on the next new packet
+};
+
+struct nrf {
+  uint8_t  reg[0x20];
+  uint8_t  addr[6][5];                 // RX_ADDR_P0..P5 and TX_ADDR as written
+  struct nrfpayload rx[NRFFIFO], tx[NRFFIFO];
+  int      rxcount, txcount;
+  int      sending;                    // Head of TX FIFO in the air, or waiting for its ACK
+  int      arc;                        // Retransmissions of the head
+  int      attempt;                    // Transmissions made, matching ACKs to them
+  int      pid;                        // Packet ID of the head, 0..3
+  int      lastpid[6];                 // Packet ID and CRC last received on each pipe
+  uint32_t lastcrc[6];
+  struct nrfpayload lastack;           // Last ACK payload received
+  int      selected;                   // CSN low
+  int      index;                      // Byte within transaction
+  uint8_t  cmd;
+  int      popped;                     // Payload read in this transaction
+  avr_t     *avr;                      // For air timing, once attached
+  avr_irq_t *irq;                      // IRQ pin, NULL if not wired
+  int        irqlevel;
+  struct air *air;
+  uint64_t transactions, bytes, sent, received;
+  uint64_t retransmits, acked, failed; // Sending: with ACKs asked for
+  uint64_t acks;                       // Receiving: ACKs sent
+};
+
+struct flight {                        // A packet or an ACK in the air
+  struct air *air;
+  struct nrf *from;
+  struct nrf *to;                      // For an ACK, the transmitter acknowledged
+  uint8_t     payload[NRFPAYLOAD];
+  int         len;
+  uint8_t     addr[5], channel, setup, config, feature;
+  int         ack;                     // A packet asking for an ACK
+  int         pid, attempt;
+};
+
+#define NRFREASONS 9
+const char *const nrfreason[NRFREASONS] = {
+  "not listening", "channel", "data rate", "CRC", "address", "width", "ACK address", "ACK payload", "RX FIFO full"
+};
+
+struct air {
+  struct nrf   *node[NRFNODES];
+  int           nodes;
+  uint32_t      loss;                  // Packets and ACKs lost per 65536
+  uint32_t      delay;                 // us added to every flight
+  uint32_t      seed;
+  struct flight flight[NRFFLIGHTS];
+  int           nextflight;
+  uint64_t      sent, lost, delivered, repeats, mismatch[NRFREASONS];
+};
+
+void NrfReset(struct nrf *n) {
+  memset(n, 0, sizeof *n);
+  n->reg[NRFCONFIG]     = 0x08;
+  n->reg[NRFENAA]       = 0x3F;
+  n->reg[NRFENRXADDR]   = 0x03;
+  n->reg[NRFSETUPRETR]  = 0x03;
+  n->reg[NRFRFCH]       = 0x02;
+  n->reg[NRFRFSETUP]    = 0x0E;
+  n->reg[NRFSTATUS]     = 0x0E;        // RX_P_NO: RX FIFO empty
+  n->reg[NRFFIFOSTATUS] = 0x11;        // RX and TX FIFOs empty
+  for (int p=0; p<2; p++) memset(n->addr[p], p ? 0xC2 : 0xE7, 5);
+  memset(n->addr[5], 0xE7, 5);
+  for (int p=2; p<5; p++) n->addr[p][0] = 0xC1 + p;  // P2..P5 differ from P1 in their first byte
+  for (int p=0; p<6; p++) n->lastpid[p] = -1;
+  n->irqlevel = 1;
+}
+
+int NrfListening(struct nrf *n) {return (n->reg[NRFCONFIG] & 3) == 3;} // PWR_UP and PRIM_RX
+int NrfSending(struct nrf *n)   {return (n->reg[NRFCONFIG] & 3) == 2;} // PWR_UP, not PRIM_RX
+int NrfDynamic(struct nrf *n, int pipe) {return (n->reg[NRFFEATURE] & 4)  &&  (n->reg[NRFDYNPD] & 1<<pipe);}
+
+void NrfStatus(struct nrf *n) {
+  uint8_t pipe = n->rxcount ? n->rx[0].pipe : 7;
+  n->reg[NRFSTATUS] = (n->reg[NRFSTATUS] & 0x70) | pipe<<1 | (n->txcount == NRFFIFO);
+  n->reg[NRFFIFOSTATUS] = (n->rxcount == NRFFIFO) << 1 | !n->rxcount
+                        | (n->txcount == NRFFIFO) << 5 | !n->txcount << 4;
+  int level = !(n->reg[NRFSTATUS] & ~n->reg[NRFCONFIG] & 0x70);  // Active low, CONFIG masks
+  if (n->irq  &&  level != n->irqlevel) avr_raise_irq(n->irq, level);
+  n->irqlevel = level;
+}
+
+int NrfPush(struct nrf *n, const uint8_t *payload, int len, int pipe) { // Returns 0 if the FIFO is full
+  if (n->rxcount >= NRFFIFO) return 0;
+  struct nrfpayload *r = &n->rx[n->rxcount++];
+  memset(r, 0, sizeof *r);
+  memcpy(r->data, payload, len);
+  r->len  = len;
+  r->pipe = pipe;
+  n->reg[NRFSTATUS] |= 0x40;           // RX_DR
+  n->received++;
+  NrfStatus(n);
+  return 1;
+}
+
+int NrfReceive(struct nrf *n, const uint8_t *payload) {return NrfPush(n, payload, NRFPAYLOAD, 1);}
+
+void NrfDrop(struct nrf *n, int i) { // Remove TX FIFO entry i
+  memmove(&n->tx[i], &n->tx[i+1], sizeof n->tx[0] * (n->txcount - i - 1));
+  n->txcount--;
+  NrfStatus(n);
+}
+
+
+// The air
+
+int NrfPipe(struct nrf *n, const uint8_t *addr) { // Enabled pipe with this address, or -1
+  for (int p=0; p<6; p++) {
+    if (!(n->reg[NRFENRXADDR] & 1<<p)) continue;
+    const uint8_t *a = n->addr[p < 2 ? p : 1];
+    if ((p < 2 ? a[0] : n->addr[p][0]) == addr[0]  &&  !memcmp(a+1, addr+1, 4)) return p;
+  }
+  return -1;
+}
+
+int NrfLost(struct air *a) {
+  a->seed = a->seed * 1103515245 + 12345;
+  if ((a->seed >> 16 & 0xFFFF) >= a->loss) return 0;
+  a->lost++;
+  return 1;
+}
+
+uint32_t NrfCrc(const uint8_t *p, int len) {uint32_t c = len;  while (len--) c = c*31 + *p++;  return c;}
+
+struct flight *NrfFlight(struct nrf *from) { // Next free flight, with from's radio settings
+  struct air *a = from->air;
+  struct flight *f = &a->flight[a->nextflight++ % NRFFLIGHTS];
+  memset(f, 0, sizeof *f);
+  f->air = a;  f->from = from;
+  memcpy(f->addr, from->addr[5], 5);
+  f->channel = from->reg[NRFRFCH];  f->setup = from->reg[NRFRFSETUP];
+  f->config  = from->reg[NRFCONFIG];  f->feature = from->reg[NRFFEATURE];
+  return f;
+}
+
+void NrfFly(struct flight *f, uint32_t us, avr_cycle_timer_t land) { // Lands after us and the air's delay
+  us += f->air->delay;
+  if (us) avr_cycle_timer_register_usec(f->from->avr, us, land, f);
+  else    land(f->from->avr, 0, f);
+}
+
+void NrfSend(struct nrf *n);
+
+void NrfDone(struct nrf *n) { // Head of the TX FIFO sent, and acknowledged if asked
+  NrfDrop(n, 0);
+  n->sending = 0;  n->pid = (n->pid + 1) & 3;  n->sent++;
+  n->reg[NRFSTATUS] |= 0x20;           // TX_DS
+  NrfStatus(n);
+  NrfSend(n);
+}
+
+avr_cycle_count_t NrfTimeout(avr_t *avr, avr_cycle_count_t when, void *param);
+
+avr_cycle_count_t NrfAcked(avr_t *avr, avr_cycle_count_t when, void *param) {
+  struct flight *f = param;  struct nrf *n = f->to;  struct air *a = f->air;  (void)avr;  (void)when;
+  if (!n->sending  ||  f->attempt != n->attempt) return 0;   // Too late, sent again
+  int reason = -1;
+  if      (NrfPipe(n, f->addr) != 0)                              reason = 6;
+  else if (f->len  &&  (!NrfDynamic(n, 0)  ||  !(n->reg[NRFFEATURE] & 2))) reason = 7;  // EN_DPL, DPL_P0, EN_ACK_PAY
+  if (reason >= 0) {a->mismatch[reason]++;  return 0;}      // Sent again on time out
+  avr_cycle_timer_cancel(n->avr, NrfTimeout, n);
+  if (f->len) {
+    memcpy(n->lastack.data, f->payload, NRFPAYLOAD);  n->lastack.len = f->len;
+    if (!NrfPush(n, f->payload, f->len, 0)) a->mismatch[8]++;
+  }
+  n->acked++;
+  NrfDone(n);
+  return 0;
+}
+
+void NrfAck(struct nrf *n, int pipe, int fresh, struct flight *f) { // n acknowledges f on pipe
+  struct flight *ack = NrfFlight(n);
+  memcpy(ack->addr, f->addr, 5);
+  ack->to = f->from;  ack->attempt = f->attempt;
+  if (n->reg[NRFFEATURE] & 2) {        // EN_ACK_PAY: the first payload for the pipe
+    for (int i=0; i<n->txcount; i++) {
+      if (n->tx[i].pipe != pipe) continue;
+      if (fresh  &&  n->tx[i].sent) {NrfDrop(n, i--);  continue;}  // Its ACK got through
+      n->tx[i].sent = 1;
+      memcpy(ack->payload, n->tx[i].data, NRFPAYLOAD);  ack->len = n->tx[i].len;
+      break;
+    }
+  }
+  n->acks++;
+  if (!NrfLost(n->air)) NrfFly(ack, NRFSETTLE + NRFAIRBITS + 8*ack->len, NrfAcked);
+}
+
+avr_cycle_count_t NrfArrive(avr_t *avr, avr_cycle_count_t when, void *param) {
+  struct flight *f = param;  struct air *a = f->air;  (void)avr;  (void)when;
+  if (NrfLost(a)) return 0;
+  int acked = 0;
+  for (int i=0; i<a->nodes; i++) {
+    struct nrf *n = a->node[i];
+    if (n == f->from) continue;
+    int pipe = NrfPipe(n, f->addr), reason = -1, repeat = 0;
+    if      (!NrfListening(n))                                   reason = 0;
+    else if (n->reg[NRFRFCH] != f->channel)                      reason = 1;
+    else if ((n->reg[NRFRFSETUP] ^ f->setup) & 0x28)             reason = 2;  // RF_DR_LOW, RF_DR_HIGH
+    else if ((n->reg[NRFCONFIG] ^ f->config) & 0x0C)             reason = 3;  // EN_CRC, CRCO
+    else if (pipe < 0)                                           reason = 4;
+    else if (NrfDynamic(n, pipe) ? !(f->feature & 4) : n->reg[NRFRXPWP0+pipe] != f->len) reason = 5;
+    else {
+      int aa = f->ack  &&  (n->reg[NRFENAA] & 1<<pipe);
+      uint32_t crc = NrfCrc(f->payload, f->len);
+      repeat = aa  &&  n->lastpid[pipe] == f->pid  &&  n->lastcrc[pipe] == crc;
+      if (!repeat  &&  !NrfPush(n, f->payload, f->len, pipe)) reason = 8;  // No ACK either
+      else {
+        n->lastpid[pipe] = f->pid;  n->lastcrc[pipe] = crc;
+        if (aa  &&  !acked++) NrfAck(n, pipe, !repeat, f);
+      }
+    }
+    if (reason >= 0) a->mismatch[reason]++;
+    else if (repeat) a->repeats++;
+    else             a->delivered++;
+  }
+  return 0;
+}
+
+avr_cycle_count_t NrfSent(avr_t *avr, avr_cycle_count_t when, void *param) {
+  struct nrf *n = param;  (void)when;
+  struct flight *f = NrfFlight(n);
+  memcpy(f->payload, n->tx[0].data, NRFPAYLOAD);
+  f->len = n->tx[0].len;
+  f->ack = (n->reg[NRFENAA] & 1)  &&  !n->tx[0].noack;
+  f->pid = n->pid;  f->attempt = ++n->attempt;
+  n->air->sent++;
+  NrfFly(f, 0, NrfArrive);
+  if (!f->ack) NrfDone(n);
+  else avr_cycle_timer_register_usec(avr, ((n->reg[NRFSETUPRETR] >> 4) + 1) * 250, NrfTimeout, n);  // ARD
+  return 0;
+}
+
+avr_cycle_count_t NrfTimeout(avr_t *avr, avr_cycle_count_t when, void *param) { // No ACK within ARD
+  struct nrf *n = param;  (void)when;
+  if (n->arc < (n->reg[NRFSETUPRETR] & 0x0F)) {
+    n->arc++;  n->retransmits++;
+    n->reg[NRFOBSERVETX] = (n->reg[NRFOBSERVETX] & 0xF0) | n->arc;  // ARC_CNT
+    avr_cycle_timer_register_usec(avr, NRFAIRBITS + 8*n->tx[0].len, NrfSent, n);  // ARD covers the settling
+    return 0;
+  }
+  if (n->reg[NRFOBSERVETX] < 0xF0) n->reg[NRFOBSERVETX] += 0x10;  // PLOS_CNT
+  n->sending = 0;  n->failed++;
+  n->reg[NRFSTATUS] |= 0x10;           // MAX_RT
+  NrfStatus(n);
+  return 0;
+}
+
+void NrfSend(struct nrf *n) { // Start sending the head of the TX FIFO if able
+  if (!n->air  ||  n->sending  ||  !n->txcount  ||  !NrfSending(n)  ||  n->reg[NRFSTATUS] & 0x10) return;
+  n->sending = 1;  n->arc = 0;
+  n->reg[NRFOBSERVETX] &= 0xF0;
+  avr_cycle_timer_register_usec(n->avr, NRFSETTLE + NRFAIRBITS + 8*n->tx[0].len, NrfSent, n);
+}
+
+void NrfJoin(struct air *a, struct nrf *n) {
+  a->node[a->nodes++] = n;
+  n->air = a;
+}
+
+
+// SPI
+
+int NrfWriting(struct nrf *n) { // W_TX_PAYLOAD, W_TX_PAYLOAD_NOACK or W_ACK_PAYLOAD with EN_ACK_PAY
+  return n->cmd == 0xA0  ||  n->cmd == 0xB0  ||  ((n->cmd & 0xF8) == 0xA8  &&  (n->cmd & 7) < 6  &&  n->reg[NRFFEATURE] & 2);
+}
+
+void NrfSelect(struct nrf *n, int csn) {
+  if (!csn  &&  !n->selected) {n->selected = 1; n->index = 0; n->popped = 0; n->transactions++;}
+  if (csn   &&   n->selected) {
+    n->selected = 0;
+    if (n->popped  &&  n->rxcount) {   // R_RX_PAYLOAD removes the payload when CSN rises
+      memmove(&n->rx[0], &n->rx[1], sizeof n->rx[0] * (NRFFIFO-1));
+      n->rxcount--;
+      NrfStatus(n);
+    }
+    if (NrfWriting(n)  &&  n->index > 1  &&  n->txcount < NRFFIFO) {  // Payload complete
+      struct nrfpayload *t = &n->tx[n->txcount++];
+      t->len   = n->index - 1 > NRFPAYLOAD ? NRFPAYLOAD : n->index - 1;
+      t->pipe  = n->cmd & 0x08 ? n->cmd & 7 : -1;
+      t->noack = n->cmd == 0xB0  &&  n->reg[NRFFEATURE] & 1;  // EN_DYN_ACK
+      t->sent  = 0;
+      NrfStatus(n);
+    }
+    NrfSend(n);
+  }
+}
+
+uint8_t NrfByte(struct nrf *n, uint8_t mosi) { // Exchange one byte, returning MISO
+  if (!n->selected) return 0xFF;
+  n->bytes++;
+  int i = n->index++;
+  if (i == 0) {
+    n->cmd = mosi;
+    if (mosi == 0xE2) {n->rxcount = 0; NrfStatus(n);}   // FLUSH_RX
+    if (mosi == 0xE1  &&  !n->sending) {n->txcount = 0; NrfStatus(n);}   // FLUSH_TX
+    return n->reg[NRFSTATUS];
+  }
+  uint8_t r = n->cmd & 0x1F;
+  int isaddr = r == NRFRXADDRP0  ||  r == NRFRXADDRP0+1  ||  r == NRFTXADDR;
+  if (n->cmd < 0x20) {                 // R_REGISTER
+    if (isaddr) return n->addr[r == NRFTXADDR ? 5 : r-NRFRXADDRP0][(i-1) % 5];
+    if (r > NRFRXADDRP0+1  &&  r < NRFTXADDR) return n->addr[r-NRFRXADDRP0][0];
+    return n->reg[r];
+  }
+  if (n->cmd < 0x40) {                 // W_REGISTER
+    if (isaddr) {n->addr[r == NRFTXADDR ? 5 : r-NRFRXADDRP0][(i-1) % 5] = mosi; return 0;}
+    if (i > 1) return 0;
+    if (r > NRFRXADDRP0+1  &&  r < NRFTXADDR) n->addr[r-NRFRXADDRP0][0] = mosi;
+    else if (r == NRFSTATUS)    n->reg[r] &= ~(mosi & 0x70);   // Write 1 to clear
+    else if (r == NRFOBSERVETX) ;                              // Read only
+    else                        n->reg[r] = mosi;
+    if (r == NRFRFCH) n->reg[NRFOBSERVETX] &= 0x0F;            // Clears PLOS_CNT
+    NrfStatus(n);
+    return 0;
+  }
+  if (n->cmd == 0x60) return n->rxcount ? n->rx[0].len : 0;   // R_RX_PL_WID
+  if (n->cmd == 0x61) {                // R_RX_PAYLOAD
+    n->popped = 1;
+    return n->rxcount  &&  i <= n->rx[0].len ? n->rx[0].data[i-1] : 0;
+  }
+  if (NrfWriting(n)) {                 // Taken when CSN rises
+    if (n->txcount < NRFFIFO  &&  i <= NRFPAYLOAD) n->tx[n->txcount].data[i-1] = mosi;
+    return 0;
+  }
+  return 0;
+}
+
+
+// ATtiny85 USI glue
+
+#define USICR 0x2D  // Data space addresses
+#define USISR 0x2E
+#define USIDR 0x2F
+
+struct usi {
+  struct nrf *nrf;
+  uint8_t     dr, sr;
+};
+
+static uint8_t UsiRead(avr_t *avr, avr_io_addr_t addr, void *param) {
+  struct usi *u = param;  (void)avr;
+  return addr == USIDR ? u->dr : u->sr;
+}
+
+static void UsiWrite(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param) {
+  struct usi *u = param;  (void)avr;
+  switch (addr) {
+    case USIDR: u->dr = v;  break;
+    case USISR: u->sr = (u->sr & ~(v & 0xE0) & 0xF0) | (v & 0x0F);  break;  // Flags write 1 to clear
+    case USICR:
+      if (v & 1) {                     // USITC: one clock edge
+        u->sr = (u->sr & 0xF0) | ((u->sr + 1) & 0x0F);
+        if (!(u->sr & 0x0F)) {u->dr = NrfByte(u->nrf, u->dr); u->sr |= 0x40;}  // USIOIF
+      }
+      break;
+  }
+}
+
+static void NrfCsn(avr_irq_t *irq, uint32_t value, void *param) {(void)irq; NrfSelect(param, value);}
+
+void NrfAttachUsi(avr_t *avr, struct usi *u, struct nrf *n, char port, int csn) {
+  u->nrf = n;  u->dr = 0;  u->sr = 0;
+  n->avr = avr;
+  NrfSelect(n, 1);
+  avr_register_io_read (avr, USIDR, UsiRead,  u);
+  avr_register_io_read (avr, USISR, UsiRead,  u);
+  avr_register_io_write(avr, USIDR, UsiWrite, u);
+  avr_register_io_write(avr, USISR, UsiWrite, u);
+  avr_register_io_write(avr, USICR, UsiWrite, u);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), csn), NrfCsn, n);
+}
+
+
+// ATmega328 SPI glue: each byte the master sends is answered at once, to
+// be read from SPDR when simavr completes the transfer
+
+struct spi {
+  struct nrf *nrf;
+  avr_irq_t  *miso;
+};
+
+static void SpiMosi(avr_irq_t *irq, uint32_t value, void *param) {
+  struct spi *s = param;  (void)irq;
+  avr_raise_irq(s->miso, NrfByte(s->nrf, value));
+}
+
+void NrfAttachSpi(avr_t *avr, struct spi *s, struct nrf *n, char port, int csn, int irq) {
+  s->nrf  = n;
+  s->miso = avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_INPUT);
+  n->avr  = avr;
+  n->irq  = irq < 0 ? NULL : avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), irq);
+  NrfSelect(n, 1);
+  if (n->irq) avr_raise_irq(n->irq, n->irqlevel);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_OUTPUT), SpiMosi, s);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), csn), NrfCsn, n);
+}